@@ -0,0 +1,218 @@
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "announcefile.h"
+
+static_assert(sizeof(xdccd::AnnounceFileHeader) == 40, "AnnounceFileHeader must not contain padding");
+static_assert(sizeof(xdccd::AnnounceFileRow) == 64, "AnnounceFileRow must not contain padding");
+
+xdccd::AnnounceFile::AnnounceFile(const boost::filesystem::path &path)
+    : data(nullptr), length(0), header(nullptr), rows(nullptr), strings(nullptr)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if (::fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= sizeof(AnnounceFileHeader))
+    {
+        void *mapping = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            data = static_cast<const char*>(mapping);
+            length = info.st_size;
+        }
+    }
+
+    // The mapping stays valid without the descriptor
+    ::close(fd);
+
+    if (!data)
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not map announce file '" << path.string() << "'";
+        return;
+    }
+
+    auto file_header = reinterpret_cast<const AnnounceFileHeader*>(data);
+
+    if (std::memcmp(file_header->magic, xdccd::announcefile::MAGIC, sizeof(xdccd::announcefile::MAGIC)) != 0)
+    {
+        BOOST_LOG_TRIVIAL(error) << "'" << path.string() << "' is not an announce file";
+        return;
+    }
+
+    if (file_header->version != xdccd::announcefile::VERSION || file_header->row_size != sizeof(AnnounceFileRow))
+    {
+        BOOST_LOG_TRIVIAL(error) << "Unsupported announce file version in '" << path.string() << "'";
+        return;
+    }
+
+    std::size_t available = length - sizeof(AnnounceFileHeader);
+    if (file_header->row_count > available / sizeof(AnnounceFileRow) || file_header->strings_size != available - file_header->row_count * sizeof(AnnounceFileRow))
+    {
+        BOOST_LOG_TRIVIAL(error) << "Announce file '" << path.string() << "' is truncated";
+        return;
+    }
+
+    header = file_header;
+    rows = reinterpret_cast<const AnnounceFileRow*>(data + sizeof(AnnounceFileHeader));
+    strings = data + sizeof(AnnounceFileHeader) + header->row_count * sizeof(AnnounceFileRow);
+}
+
+xdccd::AnnounceFile::~AnnounceFile()
+{
+    if (data)
+        ::munmap(const_cast<char*>(data), length);
+}
+
+bool xdccd::AnnounceFile::is_open() const
+{
+    return header != nullptr;
+}
+
+std::size_t xdccd::AnnounceFile::size() const
+{
+    return header ? header->row_count : 0;
+}
+
+xdccd::timestamp_t xdccd::AnnounceFile::get_created() const
+{
+    return header ? static_cast<timestamp_t>(header->created) : 0;
+}
+
+bool xdccd::AnnounceFile::get(std::size_t i, AnnounceRow &row) const
+{
+    const AnnounceFileRow &file_row = rows[i];
+
+    row.slot = file_row.slot;
+    row.download_count = file_row.download_count;
+    row.num_size = file_row.num_size;
+    row.last_seen = file_row.last_seen;
+
+    return get_string(file_row.bot_name, file_row.bot_name_length, row.bot_name)
+        && get_string(file_row.channel, file_row.channel_length, row.channel)
+        && get_string(file_row.filename, file_row.filename_length, row.filename)
+        && get_string(file_row.size, file_row.size_length, row.size);
+}
+
+bool xdccd::AnnounceFile::get_string(std::uint64_t offset, std::uint16_t length, StringRef &str) const
+{
+    if (offset > header->strings_size || length > header->strings_size - offset)
+        return false;
+
+    str = StringRef{strings + offset, length};
+    return true;
+}
+
+bool xdccd::AnnounceFile::write(const AnnounceSnapshot &snapshot, const boost::filesystem::path &path)
+{
+    boost::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+
+    std::ofstream stream(tmp_path.string(), std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not write announce file '" << tmp_path.string() << "'";
+        return false;
+    }
+
+    std::vector<announce_id_t> ids;
+    ids.reserve(snapshot.size());
+    for (announce_id_t id = 0; id < snapshot.get_end_id(); ++id)
+    {
+        if (snapshot.is_visible(id))
+            ids.push_back(id);
+    }
+
+    std::vector<AnnounceFileRow> file_rows;
+    file_rows.reserve(ids.size());
+
+    // Strings go behind the rows, which are written once all offsets are known
+    stream.seekp(sizeof(AnnounceFileHeader) + ids.size() * sizeof(AnnounceFileRow));
+
+    // Interned strings share their data, so their address identifies them
+    std::unordered_map<const char*, std::uint64_t> interned;
+    std::uint64_t strings_size = 0;
+
+    auto add_string = [&](StringRef str) -> std::uint64_t
+    {
+        stream.write(str.data, str.length);
+        strings_size += str.length;
+        return strings_size - str.length;
+    };
+
+    auto add_interned = [&](StringRef str) -> std::uint64_t
+    {
+        auto it = interned.find(str.data);
+        if (it != interned.end())
+            return it->second;
+
+        std::uint64_t offset = add_string(str);
+        interned[str.data] = offset;
+        return offset;
+    };
+
+    std::string buffer;
+    for (announce_id_t id : ids)
+    {
+        AnnounceRow row = snapshot.get_row(id, buffer);
+
+        AnnounceFileRow file_row;
+        std::memset(&file_row, 0, sizeof(file_row));
+        file_row.bot_name = add_interned(row.bot_name);
+        file_row.channel = add_interned(row.channel);
+        file_row.filename = add_string(row.filename);
+        file_row.size = add_interned(row.size);
+        file_row.num_size = row.num_size;
+        file_row.download_count = row.download_count;
+        file_row.last_seen = row.last_seen;
+        file_row.bot_name_length = static_cast<std::uint16_t>(std::min<std::size_t>(row.bot_name.length, UINT16_MAX));
+        file_row.channel_length = static_cast<std::uint16_t>(std::min<std::size_t>(row.channel.length, UINT16_MAX));
+        file_row.filename_length = static_cast<std::uint16_t>(row.filename.length);
+        file_row.size_length = static_cast<std::uint16_t>(std::min<std::size_t>(row.size.length, UINT16_MAX));
+        file_row.slot = row.slot;
+
+        file_rows.push_back(file_row);
+    }
+
+    AnnounceFileHeader file_header;
+    std::memset(&file_header, 0, sizeof(file_header));
+    std::memcpy(file_header.magic, xdccd::announcefile::MAGIC, sizeof(xdccd::announcefile::MAGIC));
+    file_header.version = xdccd::announcefile::VERSION;
+    file_header.row_size = sizeof(AnnounceFileRow);
+    file_header.created = xdccd::store::now();
+    file_header.row_count = file_rows.size();
+    file_header.strings_size = strings_size;
+
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char*>(&file_header), sizeof(file_header));
+    stream.write(reinterpret_cast<const char*>(file_rows.data()), file_rows.size() * sizeof(AnnounceFileRow));
+    stream.close();
+
+    if (!stream)
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not write announce file '" << tmp_path.string() << "'";
+        boost::system::error_code error;
+        boost::filesystem::remove(tmp_path, error);
+        return false;
+    }
+
+    // Files mapped by a reader keep their old contents
+    boost::system::error_code error;
+    boost::filesystem::rename(tmp_path, path, error);
+    if (error)
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not replace announce file '" << path.string() << "': " << error.message();
+        return false;
+    }
+
+    return true;
+}
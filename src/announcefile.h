@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <boost/filesystem/path.hpp>
+
+#include "announcestore.h"
+
+namespace xdccd
+{
+
+namespace announcefile
+{
+static const char MAGIC[] = "XDCCANN";
+static const std::uint32_t VERSION(2);
+
+// Default age of announces not seen since that are expired, and dropped
+// when restoring them
+static const std::chrono::hours MAX_AGE(24 * 7);
+
+// Interval between checkpoints of a bot's announces
+static const std::chrono::minutes CHECKPOINT_INTERVAL(10);
+
+// Time a stopping bot waits for its io_service to save its announces, before
+// it saves what has been published without it
+static const std::chrono::seconds FINAL_CHECKPOINT_TIMEOUT(10);
+
+// Number of announces restored at once, before the bot gets to handle
+// other events again
+static const std::size_t RESTORE_BATCH(4096);
+}
+
+// Layout of an announce file, meant to be mapped into memory as is. All
+// integers are stored in host byte order, a file written on a machine with a
+// different one is rejected by its version.
+//
+//     header | rows | strings
+//
+// Strings are referenced by their offset into the strings section, interned
+// strings (bot names, channels, sizes) are only stored once.
+struct AnnounceFileHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t row_size;
+    std::uint64_t created;
+    std::uint64_t row_count;
+    std::uint64_t strings_size;
+};
+
+struct AnnounceFileRow
+{
+    std::uint64_t bot_name;
+    std::uint64_t channel;
+    std::uint64_t filename;
+    std::uint64_t size;
+    std::uint64_t num_size;
+    std::uint32_t download_count;
+    std::uint32_t last_seen;
+    std::uint16_t bot_name_length;
+    std::uint16_t channel_length;
+    std::uint16_t filename_length;
+    std::uint16_t size_length;
+    std::uint16_t slot;
+    std::uint16_t reserved[3];
+};
+
+// Read-only, memory mapped announce file. Rows are only paged in when read.
+class AnnounceFile
+{
+    public:
+        AnnounceFile(const boost::filesystem::path &path);
+        ~AnnounceFile();
+
+        AnnounceFile(const AnnounceFile&) = delete;
+        AnnounceFile &operator=(const AnnounceFile&) = delete;
+
+        bool is_open() const;
+        std::size_t size() const;
+        timestamp_t get_created() const;
+
+        // Strings of row point into the mapping, returns false for rows
+        // pointing outside of the file
+        bool get(std::size_t i, AnnounceRow &row) const;
+
+        // Writes all visible announces of snapshot. The file is replaced
+        // atomically, so a crash never leaves a broken one behind.
+        static bool write(const AnnounceSnapshot &snapshot, const boost::filesystem::path &path);
+
+    private:
+        bool get_string(std::uint64_t offset, std::uint16_t length, StringRef &str) const;
+
+        const char *data;
+        std::size_t length;
+        const AnnounceFileHeader *header;
+        const AnnounceFileRow *rows;
+        const char *strings;
+};
+
+typedef std::shared_ptr<AnnounceFile> AnnounceFilePtr;
+
+}
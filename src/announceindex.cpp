@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <iterator>
+#include <boost/algorithm/string.hpp>
+
+#include "announceindex.h"
+#include "stringmatch.h"
+
+namespace
+{
+    // Bits of the trigram filter per trigram, and bits set for each of them
+    static const std::size_t FILTER_BITS(16);
+    static const unsigned int FILTER_HASHES(4);
+
+    // Finalizer of MurmurHash3
+    std::uint64_t hash_trigram(std::uint32_t trigram)
+    {
+        std::uint64_t key = trigram;
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+
+        return key;
+    }
+
+    // The low bits of hash choose the word, the high ones its bits
+    std::uint64_t filter_mask(std::uint64_t hash)
+    {
+        std::uint64_t mask = 0;
+        for (unsigned int i = 0; i < FILTER_HASHES; ++i)
+            mask |= std::uint64_t(1) << ((hash >> (64 - 6 * (i + 1))) & 63);
+
+        return mask;
+    }
+
+    void set_bit(std::vector<std::uint64_t> &bits, std::size_t bit)
+    {
+        bits[bit / 64] |= std::uint64_t(1) << (bit % 64);
+    }
+
+    bool test_bit(const std::vector<std::uint64_t> &bits, std::size_t bit)
+    {
+        return bits[bit / 64] & (std::uint64_t(1) << (bit % 64));
+    }
+}
+
+std::vector<std::string> xdccd::AnnounceIndex::tokenize(const std::string &folded)
+{
+    std::vector<std::string> tokens;
+    boost::algorithm::split(tokens, folded, boost::algorithm::is_any_of("."));
+
+    // Every part only has to be indexed once
+    std::sort(tokens.begin(), tokens.end());
+    tokens.erase(std::unique(tokens.begin(), tokens.end()), tokens.end());
+
+    return tokens;
+}
+
+std::vector<std::uint32_t> xdccd::AnnounceIndex::trigrams(const std::string &folded)
+{
+    std::vector<std::uint32_t> result;
+
+    if (folded.size() < 3)
+        return result;
+
+    result.reserve(folded.size() - 2);
+
+    for (std::size_t i = 0; i + 2 < folded.size(); ++i)
+    {
+        // Terms never contain '.', neither do the trigrams we look up
+        if (folded[i] == '.' || folded[i + 1] == '.' || folded[i + 2] == '.')
+            continue;
+
+        result.push_back(static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i])) << 16
+                | static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i + 1])) << 8
+                | static_cast<std::uint32_t>(static_cast<unsigned char>(folded[i + 2])));
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+
+    return result;
+}
+
+void xdccd::AnnounceIndex::add(announce_id_t id, const std::string &folded)
+{
+    if (characters.empty())
+    {
+        characters.assign(256 / 64, 0);
+        pairs.assign(65536 / 64, 0);
+    }
+
+    for (std::size_t i = 0; i < folded.size(); ++i)
+    {
+        if (folded[i] == '.')
+            continue;
+
+        set_bit(characters, static_cast<unsigned char>(folded[i]));
+
+        if (i + 1 < folded.size() && folded[i + 1] != '.')
+            set_bit(pairs, static_cast<std::size_t>(static_cast<unsigned char>(folded[i])) << 8 | static_cast<unsigned char>(folded[i + 1]));
+    }
+
+    for (auto &token : tokenize(folded))
+        postings[token].push_back(id);
+
+    for (std::uint32_t trigram : trigrams(folded))
+        trigram_postings[trigram].add(id);
+}
+
+xdccd::AnnounceIndex xdccd::AnnounceIndex::merge(const AnnounceIndex &first, const AnnounceIndex &second, const announce_filter_t &keep)
+{
+    AnnounceIndex index;
+    index.append(first, keep);
+    index.append(second, keep);
+
+    return index;
+}
+
+void xdccd::AnnounceIndex::append(const AnnounceIndex &other, const announce_filter_t &keep)
+{
+    // Characters of dropped announces stay, they only let terms through
+    if (characters.empty())
+    {
+        characters = other.characters;
+        pairs = other.pairs;
+    }
+    else if (!other.characters.empty())
+    {
+        for (std::size_t i = 0; i < characters.size(); ++i)
+            characters[i] |= other.characters[i];
+
+        for (std::size_t i = 0; i < pairs.size(); ++i)
+            pairs[i] |= other.pairs[i];
+    }
+
+    if (!keep)
+    {
+        for (auto &posting : other.postings)
+        {
+            posting_list_t &list = postings[posting.first];
+            list.insert(list.end(), posting.second.begin(), posting.second.end());
+        }
+
+        for (auto &posting : other.trigram_postings)
+            trigram_postings[posting.first].concat(posting.second);
+
+        return;
+    }
+
+    for (auto &posting : other.postings)
+    {
+        posting_list_t *list = nullptr;
+
+        for (announce_id_t id : posting.second)
+        {
+            if (!keep(id))
+                continue;
+
+            // Do not create lists for parts of removed announces only
+            if (!list)
+                list = &postings[posting.first];
+
+            list->push_back(id);
+        }
+    }
+
+    for (auto &posting : other.trigram_postings)
+    {
+        CompressedPostingList *list = nullptr;
+
+        for (CompressedPostingList::Iterator it(posting.second); it.valid(); it.next())
+        {
+            if (!keep(it.value()))
+                continue;
+
+            if (!list)
+                list = &trigram_postings[posting.first];
+
+            list->add(it.value());
+        }
+    }
+}
+
+void xdccd::AnnounceIndex::seal()
+{
+    std::size_t words = 1;
+    while (words * 64 < trigram_postings.size() * FILTER_BITS)
+        words *= 2;
+
+    trigram_filter.assign(words, 0);
+    for (auto &posting : trigram_postings)
+    {
+        std::uint64_t hash = hash_trigram(posting.first);
+        trigram_filter[hash & (words - 1)] |= filter_mask(hash);
+    }
+}
+
+bool xdccd::AnnounceIndex::may_contain(const std::string &folded) const
+{
+    // Parts are split by '.', so they can never contain one
+    if (folded.find('.') != std::string::npos)
+        return false;
+
+    // Nothing added yet
+    if (characters.empty())
+        return false;
+
+    if (folded.size() == 1)
+        return test_bit(characters, static_cast<unsigned char>(folded[0]));
+
+    if (folded.size() == 2)
+        return test_bit(pairs, static_cast<std::size_t>(static_cast<unsigned char>(folded[0])) << 8 | static_cast<unsigned char>(folded[1]));
+
+    if (trigram_filter.empty())
+        return true;
+
+    for (std::uint32_t trigram : trigrams(folded))
+    {
+        std::uint64_t hash = hash_trigram(trigram);
+        std::uint64_t mask = filter_mask(hash);
+
+        if ((trigram_filter[hash & (trigram_filter.size() - 1)] & mask) != mask)
+            return false;
+    }
+
+    return true;
+}
+
+void xdccd::AnnounceIndex::find(const std::string &term, const filename_lookup_t &lookup, std::vector<announce_id_t> &result, const announce_filter_t &keep) const
+{
+    result.clear();
+
+    std::string needle = fold_case(term);
+    if (!may_contain(needle))
+        return;
+
+    if (needle.size() >= 3)
+    {
+        find_by_trigram(needle, lookup, keep, result);
+        return;
+    }
+
+    find_by_token(needle, result);
+
+    if (keep)
+        result.erase(std::remove_if(result.begin(), result.end(), [&keep](announce_id_t id) { return !keep(id); }), result.end());
+}
+
+void xdccd::AnnounceIndex::find_by_token(const std::string &needle, std::vector<announce_id_t> &result) const
+{
+    // Collect the postings of all parts containing the term
+    std::vector<const posting_list_t*> lists;
+    std::size_t total = 0;
+
+    for (auto &posting : postings)
+    {
+        if (posting.first.find(needle) == std::string::npos)
+            continue;
+
+        lists.push_back(&posting.second);
+        total += posting.second.size();
+    }
+
+    if (lists.size() == 1)
+    {
+        result = *lists.front();
+        return;
+    }
+
+    result.reserve(total);
+    for (auto list : lists)
+        result.insert(result.end(), list->begin(), list->end());
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+}
+
+void xdccd::AnnounceIndex::find_by_trigram(const std::string &needle, const filename_lookup_t &lookup, const announce_filter_t &keep, std::vector<announce_id_t> &result) const
+{
+    std::vector<const CompressedPostingList*> lists;
+
+    for (std::uint32_t trigram : trigrams(needle))
+    {
+        auto posting = trigram_postings.find(trigram);
+
+        // One of the trigrams does not appear anywhere
+        if (posting == trigram_postings.end())
+            return;
+
+        lists.push_back(&posting->second);
+    }
+
+    // Start with the shortest list, so every following step has less to do
+    std::sort(lists.begin(), lists.end(), [](const CompressedPostingList *a, const CompressedPostingList *b) { return a->size() < b->size(); });
+
+    lists.front()->decode(result);
+    for (auto it = lists.begin() + 1; it != lists.end() && !result.empty(); ++it)
+        intersect(result, **it);
+
+    // Having all trigrams does not mean they appear in the right order
+    result.erase(std::remove_if(result.begin(), result.end(), [&lookup, &keep, &needle](announce_id_t id)
+    {
+        if (keep && !keep(id))
+            return true;
+
+        StringRef filename = lookup(id);
+        return !contains_folded(filename.data, filename.length, needle);
+    }), result.end());
+}
+
+std::size_t xdccd::AnnounceIndex::get_token_count() const
+{
+    return postings.size();
+}
+
+std::size_t xdccd::AnnounceIndex::get_trigram_count() const
+{
+    return trigram_postings.size();
+}
+
+std::size_t xdccd::AnnounceIndex::get_memory_usage() const
+{
+    std::size_t usage = 0;
+
+    for (auto &posting : postings)
+        usage += posting.first.capacity() + posting.second.capacity() * sizeof(announce_id_t);
+
+    for (auto &posting : trigram_postings)
+        usage += sizeof(posting.first) + posting.second.get_memory_usage();
+
+    usage += (characters.capacity() + pairs.capacity() + trigram_filter.capacity()) * sizeof(std::uint64_t);
+
+    return usage;
+}
+
+void xdccd::intersect(const std::vector<announce_id_t> &a, const std::vector<announce_id_t> &b, std::vector<announce_id_t> &result)
+{
+    result.clear();
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(result));
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "postinglist.h"
+#include "stringarena.h"
+
+namespace xdccd
+{
+
+typedef std::function<StringRef (announce_id_t)> filename_lookup_t;
+typedef std::function<bool (announce_id_t)> announce_filter_t;
+
+// Inverted indexes over the folded filenames of announces: one from the
+// parts of filenames (split by '.') to the sorted list of announces containing
+// them, and one from the trigrams of filenames to compressed lists of
+// announces, used to find substrings of at least three characters.
+//
+// Terms that cannot be found at all are rejected up front: by a Bloom filter
+// over the trigrams, or by the exact sets of the characters and pairs of
+// characters that appear in parts, for terms too short for trigrams.
+//
+// Announces have to be added in ascending order of their IDs. Once filled and
+// sealed, an index is not modified anymore and can be shared between threads.
+class AnnounceIndex
+{
+    public:
+        void add(announce_id_t id, const std::string &folded);
+
+        // Finds all announces with a filename part containing term (ignoring
+        // case), result is sorted. lookup returns folded filenames to verify
+        // candidates found by trigram, unless they are rejected by keep (if
+        // given) already.
+        void find(const std::string &term, const filename_lookup_t &lookup, std::vector<announce_id_t> &result, const announce_filter_t &keep = announce_filter_t()) const;
+
+        // Builds the Bloom filter over the trigrams, once all announces are
+        // added. Until then, it lets every term pass.
+        void seal();
+
+        // Returns false if no filename part can contain the folded term,
+        // true if one might
+        bool may_contain(const std::string &folded) const;
+
+        // Builds an index from the announces of first followed by the ones
+        // of second, which must all have higher IDs, skipping announces
+        // rejected by keep (if given)
+        static AnnounceIndex merge(const AnnounceIndex &first, const AnnounceIndex &second, const announce_filter_t &keep);
+
+        std::size_t get_token_count() const;
+        std::size_t get_trigram_count() const;
+        std::size_t get_memory_usage() const;
+
+        static std::vector<std::string> tokenize(const std::string &folded);
+        static std::vector<std::uint32_t> trigrams(const std::string &folded);
+
+    private:
+        typedef std::vector<announce_id_t> posting_list_t;
+
+        void find_by_token(const std::string &needle, std::vector<announce_id_t> &result) const;
+        void find_by_trigram(const std::string &needle, const filename_lookup_t &lookup, const announce_filter_t &keep, std::vector<announce_id_t> &result) const;
+        void append(const AnnounceIndex &other, const announce_filter_t &keep);
+
+        std::unordered_map<std::string, posting_list_t> postings;
+        std::unordered_map<std::uint32_t, CompressedPostingList> trigram_postings;
+
+        // Bit c is set if character c appears in a part, bit (a << 8) | b if
+        // the pair ab does
+        std::vector<std::uint64_t> characters;
+        std::vector<std::uint64_t> pairs;
+
+        // Blocked Bloom filter, every trigram sets a few bits of a single word
+        std::vector<std::uint64_t> trigram_filter;
+};
+
+// Intersects two sorted lists of announces
+void intersect(const std::vector<announce_id_t> &a, const std::vector<announce_id_t> &b, std::vector<announce_id_t> &result);
+
+}
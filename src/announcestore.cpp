@@ -0,0 +1,1090 @@
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#include "announcestore.h"
+#include "stringmatch.h"
+
+namespace
+{
+    // Finalizer of MurmurHash3
+    std::uint64_t hash_key(std::uint64_t key)
+    {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+
+        return key;
+    }
+
+    std::size_t hash_key(xdccd::string_id_t bot_name, std::uint16_t slot)
+    {
+        return static_cast<std::size_t>(hash_key((static_cast<std::uint64_t>(bot_name) << 16) | slot));
+    }
+
+    // Strings of pool equal to any of names, ignoring case, indexed by their ID
+    std::vector<bool> find_names(const xdccd::StringPool::View &pool, const std::vector<std::string> &names)
+    {
+        std::vector<bool> found(pool.size(), false);
+
+        for (xdccd::string_id_t id = 0; id < pool.size(); ++id)
+        {
+            xdccd::StringRef str = pool.get(id);
+
+            for (auto &name : names)
+            {
+                if (name.size() == str.length && std::equal(name.begin(), name.end(), str.data, [](char a, char b) { return xdccd::fold_case(a) == xdccd::fold_case(b); }))
+                    found[id] = true;
+            }
+        }
+
+        return found;
+    }
+
+    bool folded_less(xdccd::StringRef a, xdccd::StringRef b)
+    {
+        return std::lexicographical_compare(a.data, a.data + a.length, b.data, b.data + b.length);
+    }
+
+    // Removes the IDs of bitmap whose values in column don't pass predicate.
+    // Goes through the column 64 values at a time, chunks are multiples of
+    // 64 values, so those are always adjacent.
+    template <typename T, typename Predicate>
+    void refine(std::vector<std::uint64_t> &bitmap, std::size_t size, const typename xdccd::ChunkedColumn<T>::View &column, Predicate predicate)
+    {
+        for (std::size_t word = 0; word < bitmap.size(); ++word)
+        {
+            if (!bitmap[word])
+                continue;
+
+            const T *values = &column[word * 64];
+            std::size_t count = std::min<std::size_t>(64, size - word * 64);
+
+            std::uint64_t passed = 0;
+            for (std::size_t i = 0; i < count; ++i)
+                passed |= static_cast<std::uint64_t>(predicate(values[i])) << i;
+
+            bitmap[word] &= passed;
+        }
+    }
+
+    template <typename T>
+    T parse_number(const std::string &str)
+    {
+        try
+        {
+            unsigned long long value = std::stoull(str);
+            return static_cast<T>(std::min<unsigned long long>(value, std::numeric_limits<T>::max()));
+        }
+        catch (const std::exception &)
+        {
+            return 0;
+        }
+    }
+}
+
+std::size_t xdccd::store::parse_size(const std::string &size)
+{
+    if (size.empty())
+        return 0;
+
+    double factor = 1;
+    if (size.back() == 'M')
+        factor = 1024;
+    else if (size.back() == 'G')
+        factor = 1024 * 1024;
+
+    try
+    {
+        return static_cast<std::size_t>(std::stod(size) * factor);
+    }
+    catch (const std::exception &)
+    {
+        return 0;
+    }
+}
+
+xdccd::timestamp_t xdccd::store::now()
+{
+    return static_cast<timestamp_t>(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+xdccd::release_t xdccd::store::release_key(StringRef filename, std::uint64_t num_size)
+{
+    // FNV-1a over the folded filename
+    std::uint64_t key = 0xcbf29ce484222325ULL;
+    for (std::size_t i = 0; i < filename.length; ++i)
+    {
+        key ^= static_cast<unsigned char>(fold_case(filename.data[i]));
+        key *= 0x100000001b3ULL;
+    }
+
+    return hash_key(key ^ num_size);
+}
+
+xdccd::DCCAnnounce::DCCAnnounce(
+        xdccd::bot_id_t bot_id,
+        xdccd::announce_id_t id,
+        const std::string &bot_name,
+        const std::string &channel,
+        const std::string &filename,
+        const std::string &size,
+        const std::string &slot,
+        const std::string &download_count,
+        std::size_t num_size)
+    : bot_id(bot_id), id(id), hash(bot_name+slot), bot_name(bot_name), channel(channel), filename(filename), size(size), slot(slot), download_count(download_count), num_size(num_size)
+{
+}
+
+bool xdccd::DCCAnnounce::compare(const std::string &other) const
+{
+    return icontains_folded(filename, fold_case(other));
+}
+
+xdccd::IndexSegment::IndexSegment(announce_id_t begin, announce_id_t end, AnnounceIndex &&index)
+    : begin(begin), end(end), index(std::move(index))
+{
+    // Segments are never added to anymore
+    this->index.seal();
+    memory_usage = this->index.get_memory_usage();
+}
+
+xdccd::AnnounceFilter::AnnounceFilter()
+    : min_size(0), max_size(UINT64_MAX), min_downloads(0), max_age(0)
+{
+}
+
+bool xdccd::AnnounceFilter::is_empty() const
+{
+    return min_size == 0 && max_size == UINT64_MAX && min_downloads == 0 && max_age == 0
+        && bot_names.empty() && channels.empty() && extensions.empty();
+}
+
+std::string xdccd::AnnounceFilter::to_string() const
+{
+    std::string description = "size:" + std::to_string(min_size) + "-" + std::to_string(max_size)
+        + " downloads:" + std::to_string(min_downloads)
+        + " age:" + std::to_string(max_age);
+
+    for (auto &name : bot_names)
+        description += " bot:" + fold_case(name);
+
+    for (auto &channel : channels)
+        description += " channel:" + fold_case(channel);
+
+    for (auto &extension : extensions)
+        description += " extension:" + fold_case(extension);
+
+    return description;
+}
+
+xdccd::AnnounceBitmap::AnnounceBitmap()
+    : size(0)
+{
+}
+
+bool xdccd::AnnounceBitmap::test(announce_id_t id) const
+{
+    return id < size && (words[id >> 6] >> (id & 63)) & 1;
+}
+
+std::size_t xdccd::AnnounceBitmap::count() const
+{
+    std::size_t result = 0;
+    for (std::uint64_t word : words)
+        result += __builtin_popcountll(word);
+
+    return result;
+}
+
+void xdccd::AnnounceBitmap::get_ids(std::vector<announce_id_t> &result) const
+{
+    result.clear();
+    result.reserve(count());
+
+    for (std::size_t i = 0; i < words.size(); ++i)
+    {
+        for (std::uint64_t word = words[i]; word; word &= word - 1)
+            result.push_back(static_cast<announce_id_t>(i * 64 + __builtin_ctzll(word)));
+    }
+}
+
+xdccd::AnnounceSnapshot::AnnounceSnapshot()
+    : bot_id(0), generation(0), epoch(0), end_id(0), indexed_end(0), live_count(0), total_size(0), memory_usage(0), expired_count(0), evicted_count(0)
+{
+}
+
+bool xdccd::AnnounceSnapshot::is_visible(announce_id_t id) const
+{
+    // Rows deleted after this snapshot was taken are still part of it
+    return id < end_id && deleted[id].load(std::memory_order_relaxed) > generation;
+}
+
+xdccd::DCCAnnouncePtr xdccd::AnnounceSnapshot::get(announce_id_t id) const
+{
+    if (!is_visible(id))
+        return nullptr;
+
+    std::string buffer;
+    return std::make_shared<DCCAnnounce>(bot_id, id,
+            bot_name_pool.get(bot_names[id]).str(),
+            channel_pool.get(channels[id]).str(),
+            get_filename(id, buffer).str(),
+            size_pool.get(sizes[id]).str(),
+            std::to_string(slots[id]),
+            std::to_string(download_counts[id].load(std::memory_order_relaxed)),
+            num_sizes[id]);
+}
+
+xdccd::DCCAnnouncePtr xdccd::AnnounceSnapshot::find(const std::string &bot_name, const std::string &slot) const
+{
+    std::uint16_t slot_number = parse_number<std::uint16_t>(slot);
+
+    // Newer rows replace older ones, so search backwards
+    for (announce_id_t id = end_id; id-- > 0; )
+    {
+        if (slots[id] == slot_number && bot_name_pool.get(bot_names[id]) == bot_name && is_visible(id))
+            return get(id);
+    }
+
+    return nullptr;
+}
+
+void xdccd::AnnounceSnapshot::find(const std::string &term, std::vector<announce_id_t> &result, const AnnounceBitmap *allowed) const
+{
+    result.clear();
+
+    std::string needle = fold_case(term);
+    if (needle.find('.') != std::string::npos)
+        return;
+
+    std::string buffer;
+    filename_lookup_t lookup = [this, &buffer](announce_id_t id) { return get_folded_filename(id, buffer); };
+    std::vector<announce_id_t> postings;
+
+    // Filenames of announces not allowed anyway are never looked at
+    announce_filter_t keep;
+    if (allowed)
+        keep = [allowed](announce_id_t id) { return allowed->test(id); };
+
+    // Segments cover ascending, disjoint ranges of IDs, so the result stays sorted
+    for (auto &segment : segments)
+    {
+        segment->index.find(needle, lookup, postings, keep);
+        result.insert(result.end(), postings.begin(), postings.end());
+    }
+
+    for (announce_id_t id = indexed_end; id < end_id; ++id)
+    {
+        if (allowed && !allowed->test(id))
+            continue;
+
+        StringRef filename = get_folded_filename(id, buffer);
+        if (contains_folded(filename.data, filename.length, needle))
+            result.push_back(id);
+    }
+
+    result.erase(std::remove_if(result.begin(), result.end(), [this](announce_id_t id) { return !is_visible(id); }), result.end());
+}
+
+bool xdccd::AnnounceSnapshot::may_contain(const std::string &term) const
+{
+    std::string needle = fold_case(term);
+    if (needle.find('.') != std::string::npos)
+        return false;
+
+    for (auto &segment : segments)
+    {
+        if (segment->index.may_contain(needle))
+            return true;
+    }
+
+    std::string buffer;
+    for (announce_id_t id = indexed_end; id < end_id; ++id)
+    {
+        StringRef filename = get_folded_filename(id, buffer);
+        if (contains_folded(filename.data, filename.length, needle))
+            return true;
+    }
+
+    return false;
+}
+
+void xdccd::AnnounceSnapshot::filter(const AnnounceFilter &filter, AnnounceBitmap &result) const
+{
+    result.size = end_id;
+    result.words.assign((end_id + 63) / 64, ~std::uint64_t(0));
+
+    // Bits past the end stay cleared
+    if (end_id % 64)
+        result.words.back() = (std::uint64_t(1) << (end_id % 64)) - 1;
+
+    generation_t visible_generation = generation;
+    refine<std::atomic<generation_t>>(result.words, end_id, deleted, [visible_generation](const std::atomic<generation_t> &deleted_in) { return deleted_in.load(std::memory_order_relaxed) > visible_generation; });
+
+    if (filter.min_size > 0 || filter.max_size < UINT64_MAX)
+    {
+        std::uint64_t min_size = filter.min_size, max_size = filter.max_size;
+        refine<std::uint64_t>(result.words, end_id, num_sizes, [min_size, max_size](std::uint64_t size) { return size >= min_size && size <= max_size; });
+    }
+
+    if (filter.min_downloads > 0)
+    {
+        std::uint32_t min_downloads = filter.min_downloads;
+        refine<std::atomic<std::uint32_t>>(result.words, end_id, download_counts, [min_downloads](const std::atomic<std::uint32_t> &downloads) { return downloads.load(std::memory_order_relaxed) >= min_downloads; });
+    }
+
+    if (filter.max_age > 0)
+    {
+        timestamp_t now = xdccd::store::now();
+        timestamp_t oldest = now > filter.max_age ? now - filter.max_age : 0;
+        refine<std::atomic<timestamp_t>>(result.words, end_id, last_seen, [oldest](const std::atomic<timestamp_t> &seen) { return seen.load(std::memory_order_relaxed) >= oldest; });
+    }
+
+    // Names are compared by their interned IDs
+    auto refine_names = [&result, this](const ChunkedColumn<string_id_t>::View &column, const StringPool::View &pool, const std::vector<std::string> &names)
+    {
+        if (names.empty())
+            return;
+
+        std::vector<bool> found = find_names(pool, names);
+        refine<string_id_t>(result.words, end_id, column, [&found](string_id_t id) { return id < found.size() && found[id]; });
+    };
+
+    refine_names(bot_names, bot_name_pool, filter.bot_names);
+    refine_names(channels, channel_pool, filter.channels);
+    refine_names(extensions, extension_pool, filter.extensions);
+}
+
+xdccd::StringRef xdccd::AnnounceSnapshot::get_filename(announce_id_t id, std::string &buffer) const
+{
+    if (filenames[id] & xdccd::store::COLD_FILENAME)
+    {
+        cold_filenames->get(filenames[id] & ~xdccd::store::COLD_FILENAME, buffer);
+        return StringRef{buffer.data(), buffer.size()};
+    }
+
+    return filename_arena.get(filenames[id], filename_lengths[id]);
+}
+
+xdccd::StringRef xdccd::AnnounceSnapshot::get_folded_filename(announce_id_t id, std::string &buffer) const
+{
+    // Cold filenames don't have a folded copy
+    if (filenames[id] & xdccd::store::COLD_FILENAME)
+    {
+        cold_filenames->get(filenames[id] & ~xdccd::store::COLD_FILENAME, buffer);
+        for (char &c : buffer)
+            c = fold_case(c);
+
+        return StringRef{buffer.data(), buffer.size()};
+    }
+
+    return folded_filename_arena.get(filenames[id], filename_lengths[id]);
+}
+
+xdccd::AnnounceRow xdccd::AnnounceSnapshot::get_row(announce_id_t id, std::string &buffer) const
+{
+    return AnnounceRow{
+        bot_name_pool.get(bot_names[id]),
+        channel_pool.get(channels[id]),
+        get_filename(id, buffer),
+        size_pool.get(sizes[id]),
+        slots[id],
+        download_counts[id].load(std::memory_order_relaxed),
+        num_sizes[id],
+        last_seen[id].load(std::memory_order_relaxed)};
+}
+
+xdccd::release_t xdccd::AnnounceSnapshot::get_release(announce_id_t id) const
+{
+    return releases[id];
+}
+
+void xdccd::AnnounceSnapshot::get_last_seen(std::vector<timestamp_t> &result) const
+{
+    for (announce_id_t id = 0; id < end_id; ++id)
+    {
+        if (is_visible(id))
+            result.push_back(last_seen[id].load(std::memory_order_relaxed));
+    }
+}
+
+xdccd::announce_id_t xdccd::AnnounceSnapshot::get_end_id() const
+{
+    return end_id;
+}
+
+xdccd::generation_t xdccd::AnnounceSnapshot::get_generation() const
+{
+    return generation;
+}
+
+xdccd::generation_t xdccd::AnnounceSnapshot::get_epoch() const
+{
+    return epoch;
+}
+
+std::size_t xdccd::AnnounceSnapshot::size() const
+{
+    return live_count;
+}
+
+xdccd::file_size_t xdccd::AnnounceSnapshot::get_total_size() const
+{
+    return total_size;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_memory_usage() const
+{
+    return memory_usage;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_segment_count() const
+{
+    return segments.size();
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_token_count() const
+{
+    std::size_t count = 0;
+    for (auto &segment : segments)
+        count += segment->index.get_token_count();
+
+    return count;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_trigram_count() const
+{
+    std::size_t count = 0;
+    for (auto &segment : segments)
+        count += segment->index.get_trigram_count();
+
+    return count;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_index_memory_usage() const
+{
+    std::size_t usage = 0;
+    for (auto &segment : segments)
+        usage += segment->memory_usage;
+
+    return usage;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_expired_count() const
+{
+    return expired_count;
+}
+
+std::size_t xdccd::AnnounceSnapshot::get_evicted_count() const
+{
+    return evicted_count;
+}
+
+xdccd::AnnounceStore::AnnounceStore(bot_id_t bot_id)
+    : bot_id(bot_id),
+    filename_arena(xdccd::arena::BLOCK_SIZE, xdccd::store::COLD_FILENAME),
+    folded_filename_arena(xdccd::arena::BLOCK_SIZE, xdccd::store::COLD_FILENAME),
+    cold_filenames(std::make_shared<FrontCodedStrings>()),
+    key_count(0),
+    indexed_end(0),
+    generation(0),
+    epoch(0),
+    published_end(0),
+    live_count(0),
+    total_size(0),
+    expired_count(0),
+    evicted_count(0)
+{
+    publish();
+}
+
+xdccd::announce_id_t xdccd::AnnounceStore::add(const std::string &bot_name, const std::string &channel, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count)
+{
+    AnnounceRow row;
+    row.bot_name = StringRef{bot_name.data(), bot_name.size()};
+    row.channel = StringRef{channel.data(), channel.size()};
+    row.filename = StringRef{filename.data(), filename.size()};
+    row.size = StringRef{size.data(), size.size()};
+    row.slot = parse_number<std::uint16_t>(slot);
+    row.download_count = parse_number<std::uint32_t>(download_count);
+    row.num_size = xdccd::store::parse_size(size);
+    row.last_seen = xdccd::store::now();
+
+    return update(row);
+}
+
+std::size_t xdccd::AnnounceStore::add(const std::vector<AnnounceRow> &rows)
+{
+    std::size_t end = bot_names.size();
+
+    for (auto &row : rows)
+        update(row);
+
+    std::size_t added = bot_names.size() - end;
+    if (added)
+        publish();
+
+    return added;
+}
+
+bool xdccd::AnnounceStore::touch(const std::string &bot_name, std::uint16_t slot, std::uint32_t download_count, timestamp_t seen)
+{
+    string_id_t bot_name_id;
+    if (key_table.empty() || !bot_name_pool.find(bot_name, bot_name_id))
+        return false;
+
+    announce_id_t id = key_table[find_key(bot_name_id, slot)];
+    if (id == xdccd::store::NO_ANNOUNCE)
+        return false;
+
+    download_counts[id].store(download_count, std::memory_order_relaxed);
+    last_seen[id].store(seen, std::memory_order_relaxed);
+    return true;
+}
+
+std::size_t xdccd::AnnounceStore::restore(const std::vector<AnnounceRow> &rows)
+{
+    std::size_t restored = 0;
+
+    for (auto &row : rows)
+    {
+        string_id_t bot_name_id = bot_name_pool.intern(row.bot_name.str());
+        std::size_t key = reserve_key(bot_name_id, row.slot);
+
+        // Whatever has been announced since is more recent
+        if (key_table[key] != xdccd::store::NO_ANNOUNCE)
+            continue;
+
+        key_count++;
+        append(key, bot_name_id, channel_pool.intern(row.channel.str()), StringRef{row.filename.data, std::min<std::size_t>(row.filename.length, UINT16_MAX)}, size_pool.intern(row.size.str()), row.slot, row.download_count, row.num_size, row.last_seen);
+        restored++;
+    }
+
+    if (restored)
+        publish();
+
+    return restored;
+}
+
+std::size_t xdccd::AnnounceStore::expire(timestamp_t oldest)
+{
+    std::size_t count = 0;
+
+    for (announce_id_t id = 0; id < bot_names.size(); ++id)
+    {
+        if (is_live(id) && last_seen[id].load(std::memory_order_relaxed) < oldest)
+        {
+            erase(id);
+            count++;
+        }
+    }
+
+    expired_count += count;
+
+    if (count)
+        publish();
+
+    return count;
+}
+
+std::size_t xdccd::AnnounceStore::evict(std::size_t count)
+{
+    count = std::min(count, live_count);
+    if (count == 0)
+        return 0;
+
+    std::vector<std::pair<timestamp_t, announce_id_t>> candidates;
+    candidates.reserve(live_count);
+    for (announce_id_t id = 0; id < bot_names.size(); ++id)
+    {
+        if (is_live(id))
+            candidates.emplace_back(last_seen[id].load(std::memory_order_relaxed), id);
+    }
+
+    std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+
+    for (std::size_t i = 0; i < count; ++i)
+        erase(candidates[i].second);
+
+    evicted_count += count;
+    publish();
+
+    return count;
+}
+
+bool xdccd::AnnounceStore::vacuum(bool force, timestamp_t cold_before)
+{
+    std::size_t dead = bot_names.size() - live_count;
+
+    // Announces only go cold, or hot again, when the store is rebuilt
+    std::size_t moved = 0;
+    for (announce_id_t id = 0; id < bot_names.size(); ++id)
+    {
+        if (is_live(id) && ((filenames[id] & xdccd::store::COLD_FILENAME) != 0) != (last_seen[id].load(std::memory_order_relaxed) < cold_before))
+            moved++;
+    }
+
+    bool purge = dead > 0 && (force || dead * xdccd::store::VACUUM_RATIO > bot_names.size());
+    if (!purge && moved * xdccd::store::VACUUM_RATIO <= bot_names.size())
+        return false;
+
+    // Rows are copied from the snapshot, which keeps the current columns
+    // alive until then, so it has to have all of them
+    flush();
+    AnnounceSnapshotPtr old = snapshot();
+
+    std::vector<announce_id_t> live_ids, cold_ids;
+    live_ids.reserve(live_count);
+    for (announce_id_t id = 0; id < old->end_id; ++id)
+    {
+        if (!is_live(id))
+            continue;
+
+        live_ids.push_back(id);
+        if (last_seen[id].load(std::memory_order_relaxed) < cold_before)
+            cold_ids.push_back(id);
+    }
+
+    std::vector<string_id_t> cold_index;
+    std::shared_ptr<FrontCodedStrings> cold = build_cold_filenames(*old, cold_ids, cold_index);
+
+    bot_names = ChunkedColumn<string_id_t>();
+    slots = ChunkedColumn<std::uint16_t>();
+    download_counts = ChunkedColumn<std::atomic<std::uint32_t>>();
+    sizes = ChunkedColumn<string_id_t>();
+    num_sizes = ChunkedColumn<std::uint64_t>();
+    filenames = ChunkedColumn<string_id_t>();
+    filename_lengths = ChunkedColumn<std::uint16_t>();
+    deleted = ChunkedColumn<std::atomic<generation_t>>();
+    last_seen = ChunkedColumn<std::atomic<timestamp_t>>();
+    releases = ChunkedColumn<release_t>();
+    channels = ChunkedColumn<string_id_t>();
+    extensions = ChunkedColumn<string_id_t>();
+
+    // Names of bots that are gone are dropped as well
+    filename_arena = StringArena(xdccd::arena::BLOCK_SIZE, xdccd::store::COLD_FILENAME);
+    folded_filename_arena = StringArena(xdccd::arena::BLOCK_SIZE, xdccd::store::COLD_FILENAME);
+    cold_filenames = cold;
+    bot_name_pool = StringPool();
+    size_pool = StringPool();
+    channel_pool = StringPool();
+    extension_pool = StringPool();
+
+    std::vector<announce_id_t>().swap(key_table);
+    key_count = 0;
+    segments.clear();
+    indexed_end = 0;
+    live_count = 0;
+    total_size = 0;
+
+    // Generations keep counting, so cached results of the old rows are
+    // recognized as outdated
+    epoch++;
+
+    std::string buffer;
+    std::size_t next_cold = 0;
+
+    for (announce_id_t id : live_ids)
+    {
+        string_id_t bot_name = bot_name_pool.intern(old->bot_name_pool.get(old->bot_names[id]).str());
+        string_id_t channel = channel_pool.intern(old->channel_pool.get(old->channels[id]).str());
+        string_id_t size = size_pool.intern(old->size_pool.get(old->sizes[id]).str());
+        std::uint32_t download_count = old->download_counts[id].load(std::memory_order_relaxed);
+        timestamp_t seen = old->last_seen[id].load(std::memory_order_relaxed);
+
+        std::size_t key = reserve_key(bot_name, old->slots[id]);
+        key_count++;
+
+        // Both are sorted by ID
+        if (next_cold < cold_ids.size() && cold_ids[next_cold] == id)
+        {
+            string_id_t extension = extension_pool.intern(old->extension_pool.get(old->extensions[id]).str());
+            append_row(key, bot_name, channel, cold_index[next_cold++] | xdccd::store::COLD_FILENAME, old->filename_lengths[id], size, old->slots[id], download_count, old->num_sizes[id], seen, old->releases[id], extension);
+        }
+        else
+            append(key, bot_name, channel, old->get_filename(id, buffer), size, old->slots[id], download_count, old->num_sizes[id], seen);
+    }
+
+    publish();
+    return true;
+}
+
+std::shared_ptr<xdccd::FrontCodedStrings> xdccd::AnnounceStore::build_cold_filenames(const AnnounceSnapshot &old, const std::vector<announce_id_t> &cold_ids, std::vector<string_id_t> &cold_index)
+{
+    // Filenames that are cold already are sorted, the ones going cold are
+    // sorted on their own and merged in, so every filename is only decoded
+    // once. Positions in cold_ids:
+    std::vector<std::size_t> was_cold, was_hot;
+
+    // Indexes share the filename column with arena IDs
+    if (cold_ids.size() > xdccd::store::COLD_FILENAME)
+        throw std::length_error("Too many cold filenames");
+
+    for (std::size_t i = 0; i < cold_ids.size(); ++i)
+    {
+        if (old.filenames[cold_ids[i]] & xdccd::store::COLD_FILENAME)
+            was_cold.push_back(i);
+        else
+            was_hot.push_back(i);
+    }
+
+    std::sort(was_cold.begin(), was_cold.end(), [&](std::size_t a, std::size_t b) { return old.filenames[cold_ids[a]] < old.filenames[cold_ids[b]]; });
+
+    // Hot filenames have a folded copy, the buffer is never used
+    std::string unused;
+    std::sort(was_hot.begin(), was_hot.end(), [&](std::size_t a, std::size_t b) { return folded_less(old.get_folded_filename(cold_ids[a], unused), old.get_folded_filename(cold_ids[b], unused)); });
+
+    auto cold = std::make_shared<FrontCodedStrings>();
+    cold_index.assign(cold_ids.size(), 0);
+
+    FrontCodedStrings::Iterator it(*old.cold_filenames);
+    std::string folded;
+    std::size_t folded_index = SIZE_MAX;
+
+    for (std::size_t hot = 0, next_cold = 0; hot < was_hot.size() || next_cold < was_cold.size(); )
+    {
+        if (next_cold < was_cold.size())
+        {
+            std::size_t index = old.filenames[cold_ids[was_cold[next_cold]]] & ~xdccd::store::COLD_FILENAME;
+            if (index != folded_index)
+            {
+                while (it.index() != index)
+                    it.next();
+
+                folded = fold_case(it.value());
+                folded_index = index;
+            }
+        }
+
+        if (next_cold == was_cold.size() || (hot < was_hot.size() && folded_less(old.get_folded_filename(cold_ids[was_hot[hot]], unused), StringRef{folded.data(), folded.size()})))
+        {
+            cold_index[was_hot[hot]] = static_cast<string_id_t>(cold->add(old.get_filename(cold_ids[was_hot[hot]], unused)));
+            hot++;
+        }
+        else
+        {
+            cold_index[was_cold[next_cold]] = static_cast<string_id_t>(cold->add(StringRef{it.value().data(), it.value().size()}));
+            next_cold++;
+        }
+    }
+
+    cold->shrink_to_fit();
+    return cold;
+}
+
+bool xdccd::AnnounceStore::flush()
+{
+    if (bot_names.size() == published_end)
+        return false;
+
+    publish();
+    return true;
+}
+
+std::size_t xdccd::AnnounceStore::get_unpublished_count() const
+{
+    return bot_names.size() - published_end;
+}
+
+xdccd::AnnounceSnapshotPtr xdccd::AnnounceStore::snapshot() const
+{
+    return std::atomic_load(&current);
+}
+
+xdccd::announce_id_t xdccd::AnnounceStore::get_end_id() const
+{
+    return static_cast<announce_id_t>(bot_names.size());
+}
+
+std::size_t xdccd::AnnounceStore::reserve_key(string_id_t bot_name, std::uint16_t slot)
+{
+    if ((key_count + 1) * 2 > key_table.size())
+        grow_table();
+
+    return find_key(bot_name, slot);
+}
+
+std::size_t xdccd::AnnounceStore::find_key(string_id_t bot_name, std::uint16_t slot) const
+{
+    std::size_t mask = key_table.size() - 1;
+
+    // Linear probing, the table is at most half full
+    for (std::size_t pos = hash_key(bot_name, slot) & mask; ; pos = (pos + 1) & mask)
+    {
+        announce_id_t id = key_table[pos];
+
+        if (id == xdccd::store::NO_ANNOUNCE || (bot_names[id] == bot_name && slots[id] == slot))
+            return pos;
+    }
+}
+
+void xdccd::AnnounceStore::erase_key(std::size_t pos)
+{
+    std::size_t mask = key_table.size() - 1;
+
+    // Move following keys of the same probe sequence up, so lookups never
+    // stop at the gap before reaching them
+    for (std::size_t next = (pos + 1) & mask; key_table[next] != xdccd::store::NO_ANNOUNCE; next = (next + 1) & mask)
+    {
+        announce_id_t id = key_table[next];
+        std::size_t home = hash_key(bot_names[id], slots[id]) & mask;
+
+        if (((next - home) & mask) >= ((next - pos) & mask))
+        {
+            key_table[pos] = id;
+            pos = next;
+        }
+    }
+
+    key_table[pos] = xdccd::store::NO_ANNOUNCE;
+    key_count--;
+}
+
+void xdccd::AnnounceStore::grow_table()
+{
+    std::vector<announce_id_t> old_table(std::max<std::size_t>(key_table.size() * 2, 1024), xdccd::store::NO_ANNOUNCE);
+    key_table.swap(old_table);
+
+    for (announce_id_t id : old_table)
+    {
+        if (id != xdccd::store::NO_ANNOUNCE)
+            key_table[find_key(bot_names[id], slots[id])] = id;
+    }
+}
+
+xdccd::announce_id_t xdccd::AnnounceStore::update(const AnnounceRow &row)
+{
+    string_id_t bot_name_id = bot_name_pool.intern(row.bot_name.str());
+    string_id_t size_id = size_pool.intern(row.size.str());
+    StringRef filename{row.filename.data, std::min<std::size_t>(row.filename.length, UINT16_MAX)};
+
+    std::size_t key = reserve_key(bot_name_id, row.slot);
+    announce_id_t old_id = key_table[key];
+
+    if (old_id != xdccd::store::NO_ANNOUNCE)
+    {
+        std::string buffer;
+        StringRef old_filename = get_filename(old_id, buffer);
+
+        // Download counts are informational only, so they are not versioned
+        if (sizes[old_id] == size_id && old_filename.length == filename.length && std::equal(filename.data, filename.data + filename.length, old_filename.data))
+        {
+            download_counts[old_id].store(row.download_count, std::memory_order_relaxed);
+            last_seen[old_id].store(row.last_seen, std::memory_order_relaxed);
+            return old_id;
+        }
+
+        // Readers of older snapshots still see the old row
+        deleted[old_id].store(generation + 1, std::memory_order_relaxed);
+        live_count--;
+        total_size -= num_sizes[old_id];
+    }
+    else
+        key_count++;
+
+    return append(key, bot_name_id, channel_pool.intern(row.channel.str()), filename, size_id, row.slot, row.download_count, row.num_size, row.last_seen);
+}
+
+xdccd::announce_id_t xdccd::AnnounceStore::append(std::size_t key, string_id_t bot_name, string_id_t channel, StringRef filename, string_id_t size, std::uint16_t slot, std::uint32_t download_count, std::uint64_t num_size, timestamp_t seen)
+{
+    std::string folded(filename.data, filename.length);
+    for (char &c : folded)
+        c = fold_case(c);
+
+    string_id_t filename_id = filename_arena.add(filename.data, filename.length);
+    folded_filename_arena.add(folded);
+
+    return append_row(key, bot_name, channel, filename_id, static_cast<std::uint16_t>(filename.length), size, slot, download_count, num_size, seen, xdccd::store::release_key(filename, num_size), intern_extension(filename));
+}
+
+xdccd::announce_id_t xdccd::AnnounceStore::append_row(std::size_t key, string_id_t bot_name, string_id_t channel, string_id_t filename, std::uint16_t filename_length, string_id_t size, std::uint16_t slot, std::uint32_t download_count, std::uint64_t num_size, timestamp_t seen, release_t release, string_id_t extension)
+{
+    announce_id_t id = static_cast<announce_id_t>(bot_names.size());
+
+    bot_names.push_back(bot_name);
+    slots.push_back(slot);
+    download_counts.push_back(download_count);
+    sizes.push_back(size);
+    num_sizes.push_back(num_size);
+    filenames.push_back(filename);
+    filename_lengths.push_back(filename_length);
+    deleted.push_back(xdccd::store::NOT_DELETED);
+    last_seen.push_back(seen);
+    releases.push_back(release);
+    channels.push_back(channel);
+    extensions.push_back(extension);
+
+    key_table[key] = id;
+    live_count++;
+    total_size += num_size;
+
+    if (bot_names.size() - indexed_end >= xdccd::store::SEGMENT_SIZE)
+        seal_segment();
+
+    return id;
+}
+
+xdccd::string_id_t xdccd::AnnounceStore::intern_extension(StringRef filename)
+{
+    const char *end = filename.data + filename.length;
+    const char *dot = std::find(std::reverse_iterator<const char*>(end), std::reverse_iterator<const char*>(filename.data), '.').base();
+
+    std::string extension;
+    if (dot != filename.data && static_cast<std::size_t>(end - dot) <= xdccd::store::MAX_EXTENSION_LENGTH)
+    {
+        extension.assign(dot, end);
+        for (char &c : extension)
+            c = fold_case(c);
+    }
+
+    return extension_pool.intern(extension);
+}
+
+void xdccd::AnnounceStore::erase(announce_id_t id)
+{
+    // Readers of older snapshots still see the row
+    deleted[id].store(generation + 1, std::memory_order_relaxed);
+    live_count--;
+    total_size -= num_sizes[id];
+    erase_key(find_key(bot_names[id], slots[id]));
+}
+
+bool xdccd::AnnounceStore::is_live(announce_id_t id) const
+{
+    return deleted[id].load(std::memory_order_relaxed) == xdccd::store::NOT_DELETED;
+}
+
+xdccd::StringRef xdccd::AnnounceStore::get_filename(announce_id_t id, std::string &buffer) const
+{
+    if (filenames[id] & xdccd::store::COLD_FILENAME)
+    {
+        cold_filenames->get(filenames[id] & ~xdccd::store::COLD_FILENAME, buffer);
+        return StringRef{buffer.data(), buffer.size()};
+    }
+
+    return filename_arena.get(filenames[id], filename_lengths[id]);
+}
+
+xdccd::StringRef xdccd::AnnounceStore::get_folded_filename(announce_id_t id, std::string &buffer) const
+{
+    if (filenames[id] & xdccd::store::COLD_FILENAME)
+    {
+        cold_filenames->get(filenames[id] & ~xdccd::store::COLD_FILENAME, buffer);
+        for (char &c : buffer)
+            c = fold_case(c);
+
+        return StringRef{buffer.data(), buffer.size()};
+    }
+
+    return folded_filename_arena.get(filenames[id], filename_lengths[id]);
+}
+
+void xdccd::AnnounceStore::seal_segment()
+{
+    announce_id_t end = static_cast<announce_id_t>(bot_names.size());
+
+    AnnounceIndex index;
+    std::string buffer;
+    for (announce_id_t id = indexed_end; id < end; ++id)
+    {
+        if (is_live(id))
+            index.add(id, get_folded_filename(id, buffer).str());
+    }
+
+    IndexSegmentPtr segment = std::make_shared<IndexSegment>(indexed_end, end, std::move(index));
+    indexed_end = end;
+
+    // Merge segments of similar size, so there are only logarithmically many.
+    // Snapshots still using the old segments keep them alive.
+    while (!segments.empty() && segments.back()->end - segments.back()->begin <= segment->end - segment->begin)
+    {
+        IndexSegmentPtr previous = segments.back();
+        segments.pop_back();
+
+        announce_id_t begin = previous->begin;
+        std::size_t deleted_count = 0;
+        for (announce_id_t id = begin; id < segment->end; ++id)
+            deleted_count += !is_live(id);
+
+        // Dropping deleted announces means decoding every list, only do it
+        // once they make up a good part of the index
+        announce_filter_t keep;
+        if (deleted_count * xdccd::store::PURGE_RATIO > segment->end - begin)
+            keep = [this](announce_id_t id) { return is_live(id); };
+
+        segment = std::make_shared<IndexSegment>(begin, segment->end, AnnounceIndex::merge(previous->index, segment->index, keep));
+    }
+
+    segments.push_back(segment);
+}
+
+void xdccd::AnnounceStore::publish()
+{
+    auto next = std::make_shared<AnnounceSnapshot>();
+
+    next->bot_id = bot_id;
+    next->generation = ++generation;
+    next->epoch = epoch;
+    next->end_id = static_cast<announce_id_t>(bot_names.size());
+    published_end = next->end_id;
+    next->indexed_end = indexed_end;
+    next->live_count = live_count;
+    next->total_size = total_size;
+    next->memory_usage = get_memory_usage();
+    next->expired_count = expired_count;
+    next->evicted_count = evicted_count;
+
+    next->bot_names = bot_names.view();
+    next->slots = slots.view();
+    next->download_counts = download_counts.view();
+    next->sizes = sizes.view();
+    next->num_sizes = num_sizes.view();
+    next->filenames = filenames.view();
+    next->filename_lengths = filename_lengths.view();
+    next->deleted = deleted.view();
+    next->last_seen = last_seen.view();
+    next->releases = releases.view();
+    next->channels = channels.view();
+    next->extensions = extensions.view();
+
+    next->filename_arena = filename_arena.view();
+    next->folded_filename_arena = folded_filename_arena.view();
+    next->cold_filenames = cold_filenames;
+    next->bot_name_pool = bot_name_pool.view();
+    next->size_pool = size_pool.view();
+    next->channel_pool = channel_pool.view();
+    next->extension_pool = extension_pool.view();
+
+    next->segments = segments;
+
+    std::atomic_store(&current, AnnounceSnapshotPtr(std::move(next)));
+}
+
+std::size_t xdccd::AnnounceStore::get_memory_usage() const
+{
+    return bot_names.get_memory_usage()
+        + slots.get_memory_usage()
+        + download_counts.get_memory_usage()
+        + sizes.get_memory_usage()
+        + num_sizes.get_memory_usage()
+        + filenames.get_memory_usage()
+        + filename_lengths.get_memory_usage()
+        + deleted.get_memory_usage()
+        + last_seen.get_memory_usage()
+        + releases.get_memory_usage()
+        + channels.get_memory_usage()
+        + extensions.get_memory_usage()
+        + filename_arena.get_memory_usage()
+        + folded_filename_arena.get_memory_usage()
+        + cold_filenames->get_memory_usage()
+        + bot_name_pool.get_memory_usage()
+        + size_pool.get_memory_usage()
+        + channel_pool.get_memory_usage()
+        + extension_pool.get_memory_usage()
+        + key_table.capacity() * sizeof(announce_id_t);
+}
@@ -0,0 +1,408 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "abstracttarget.h"
+#include "announceindex.h"
+#include "chunkedcolumn.h"
+#include "frontcodedstrings.h"
+#include "stringarena.h"
+
+namespace xdccd
+{
+
+typedef std::size_t bot_id_t;
+typedef std::uint32_t generation_t;
+
+// Seconds since the epoch
+typedef std::uint32_t timestamp_t;
+
+// Identifies a release, i.e. all announces of the same file, no matter which
+// bot offers it in which slot
+typedef std::uint64_t release_t;
+
+// A single announce, copied out of an AnnounceSnapshot
+struct DCCAnnounce
+{
+    DCCAnnounce(bot_id_t bot_id, announce_id_t id, const std::string &bot_name, const std::string &channel, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count, std::size_t num_size);
+
+    bot_id_t bot_id;
+    announce_id_t id;
+    std::string hash;
+    std::string bot_name;
+    std::string channel;
+    std::string filename;
+    std::string size;
+    std::string slot;
+    std::string download_count;
+    std::size_t num_size;
+
+    bool compare(const std::string &other) const;
+};
+
+typedef std::shared_ptr<DCCAnnounce> DCCAnnouncePtr;
+
+// Raw columns of a single announce, strings point into the store or file
+// the row was read from
+struct AnnounceRow
+{
+    StringRef bot_name;
+    StringRef channel;
+    StringRef filename;
+    StringRef size;
+    std::uint16_t slot;
+    std::uint32_t download_count;
+    std::uint64_t num_size;
+    timestamp_t last_seen;
+};
+
+namespace store
+{
+static const announce_id_t NO_ANNOUNCE(UINT32_MAX);
+static const generation_t NOT_DELETED(UINT32_MAX);
+
+// New announces are indexed in segments of this size, searches scan the ones
+// not indexed yet
+static const std::size_t SEGMENT_SIZE(1024);
+
+// Merged index segments drop deleted announces once more than 1/PURGE_RATIO
+// of them are deleted
+static const std::size_t PURGE_RATIO(4);
+
+// The store is rebuilt without its deleted rows once they make up more than
+// 1/VACUUM_RATIO of it
+static const std::size_t VACUUM_RATIO(4);
+
+// New announces are published in batches of up to this many, at least every
+// PUBLISH_INTERVAL, instead of a snapshot each
+static const std::size_t PUBLISH_BATCH(512);
+static const std::chrono::milliseconds PUBLISH_INTERVAL(250);
+
+// Entries of the filename column with this bit set are indexes into the cold
+// filenames, all others are IDs in the filename arenas, which are capped
+// below it
+static const string_id_t COLD_FILENAME(0x80000000);
+
+// Anything behind the last '.' of a filename that is longer than this is not
+// considered an extension
+static const std::size_t MAX_EXTENSION_LENGTH(8);
+
+// Parses sizes like "350M" or "1.4G" into KiB
+std::size_t parse_size(const std::string &size);
+
+timestamp_t now();
+
+// Announces are the same release if their filenames only differ in case and
+// their sizes are equal
+release_t release_key(StringRef filename, std::uint64_t num_size);
+}
+
+// Index over the announces with IDs in [begin, end)
+struct IndexSegment
+{
+    IndexSegment(announce_id_t begin, announce_id_t end, AnnounceIndex &&index);
+
+    announce_id_t begin;
+    announce_id_t end;
+    AnnounceIndex index;
+    std::size_t memory_usage;
+};
+
+typedef std::shared_ptr<const IndexSegment> IndexSegmentPtr;
+
+// Restricts searches to announces with certain properties. Names are
+// compared ignoring case, empty lists allow any.
+struct AnnounceFilter
+{
+    AnnounceFilter();
+
+    // In KiB, like DCCAnnounce::num_size
+    std::uint64_t min_size;
+    std::uint64_t max_size;
+    std::uint32_t min_downloads;
+
+    // Only announces seen within this many seconds, 0 allows any
+    std::uint32_t max_age;
+
+    std::vector<std::string> bot_names;
+    std::vector<std::string> channels;
+
+    // Without the '.'
+    std::vector<std::string> extensions;
+
+    bool is_empty() const;
+
+    // Describes the filter, equal filters have equal descriptions
+    std::string to_string() const;
+};
+
+// Set of announce IDs, one bit each
+class AnnounceBitmap
+{
+    public:
+        AnnounceBitmap();
+
+        bool test(announce_id_t id) const;
+        std::size_t count() const;
+
+        // All IDs in the set, sorted
+        void get_ids(std::vector<announce_id_t> &result) const;
+
+    private:
+        friend class AnnounceSnapshot;
+
+        std::vector<std::uint64_t> words;
+        std::size_t size;
+};
+
+// Immutable version of an AnnounceStore. Snapshots share their memory with
+// the store and can be read from any thread without locking, while the
+// store keeps adding announces.
+class AnnounceSnapshot
+{
+    public:
+        AnnounceSnapshot();
+
+        bool is_visible(announce_id_t id) const;
+        DCCAnnouncePtr get(announce_id_t id) const;
+        DCCAnnouncePtr find(const std::string &bot_name, const std::string &slot) const;
+
+        // Finds all announces with a filename containing term (ignoring
+        // case), result is sorted. Only announces in allowed (if given) are
+        // considered.
+        void find(const std::string &term, std::vector<announce_id_t> &result, const AnnounceBitmap *allowed = nullptr) const;
+
+        // Returns false if no announce can have a filename containing term
+        // (ignoring case), without looking at more than the filters of the
+        // index segments and the announces not indexed yet
+        bool may_contain(const std::string &term) const;
+
+        // Finds all visible announces passing filter. Only reads the numeric
+        // columns, names in filter are looked up once.
+        void filter(const AnnounceFilter &filter, AnnounceBitmap &result) const;
+
+        // Filenames of cold announces are decoded into buffer, the result is
+        // only valid until buffer is used again
+        StringRef get_filename(announce_id_t id, std::string &buffer) const;
+
+        // Filename of the announce with ASCII letters lowercased
+        StringRef get_folded_filename(announce_id_t id, std::string &buffer) const;
+
+        AnnounceRow get_row(announce_id_t id, std::string &buffer) const;
+        release_t get_release(announce_id_t id) const;
+
+        // Appends the time every visible announce was last seen to result
+        void get_last_seen(std::vector<timestamp_t> &result) const;
+
+        // Visible announces have IDs below this, but not every ID below it
+        // is visible
+        announce_id_t get_end_id() const;
+        generation_t get_generation() const;
+
+        // Changes whenever the store is rebuilt, which gives announces new
+        // IDs. Within an epoch, announces are only ever added at the end.
+        generation_t get_epoch() const;
+
+        std::size_t size() const;
+        file_size_t get_total_size() const;
+        std::size_t get_memory_usage() const;
+        std::size_t get_segment_count() const;
+        std::size_t get_token_count() const;
+        std::size_t get_trigram_count() const;
+        std::size_t get_index_memory_usage() const;
+
+        // Announces removed for not being seen in time, or to save memory
+        std::size_t get_expired_count() const;
+        std::size_t get_evicted_count() const;
+
+    private:
+        friend class AnnounceStore;
+
+        bot_id_t bot_id;
+        generation_t generation;
+        generation_t epoch;
+        announce_id_t end_id;
+        announce_id_t indexed_end;
+        std::size_t live_count;
+        file_size_t total_size;
+        std::size_t memory_usage;
+        std::size_t expired_count;
+        std::size_t evicted_count;
+
+        ChunkedColumn<string_id_t>::View bot_names;
+        ChunkedColumn<std::uint16_t>::View slots;
+        ChunkedColumn<std::atomic<std::uint32_t>>::View download_counts;
+        ChunkedColumn<string_id_t>::View sizes;
+        ChunkedColumn<std::uint64_t>::View num_sizes;
+        ChunkedColumn<string_id_t>::View filenames;
+        ChunkedColumn<std::uint16_t>::View filename_lengths;
+        ChunkedColumn<std::atomic<generation_t>>::View deleted;
+        ChunkedColumn<std::atomic<timestamp_t>>::View last_seen;
+        ChunkedColumn<release_t>::View releases;
+        ChunkedColumn<string_id_t>::View channels;
+        ChunkedColumn<string_id_t>::View extensions;
+
+        StringArena::View filename_arena;
+        StringArena::View folded_filename_arena;
+        std::shared_ptr<const FrontCodedStrings> cold_filenames;
+        StringPool::View bot_name_pool;
+        StringPool::View size_pool;
+        StringPool::View channel_pool;
+        StringPool::View extension_pool;
+
+        std::vector<IndexSegmentPtr> segments;
+};
+
+typedef std::shared_ptr<const AnnounceSnapshot> AnnounceSnapshotPtr;
+
+// Announces of a single DCCBot, stored as a struct-of-arrays table. Names of
+// announcing bots and sizes are interned, filenames live in an append-only
+// arena, along with a folded copy for searching.
+//
+// Optionally, the filenames of announces not seen for a while are moved to
+// a cold tier when the store is rebuilt: sorted, front-coded and without a
+// folded copy, they take a fraction of the memory, but have to be decoded
+// whenever they are looked at.
+//
+// Rows are never changed once added: an announce that changes its filename
+// or size gets a new row, the old one is marked as deleted in the generation
+// of the next snapshot. Only download counts and the time an announce was
+// last seen are updated in place. Changes are published as a new
+// AnnounceSnapshot, which is what readers work on; add() leaves that to
+// flush(), so a burst of announces shares a single snapshot.
+//
+// Only the thread adding announces may call anything but snapshot().
+class AnnounceStore
+{
+    public:
+        AnnounceStore(bot_id_t bot_id);
+
+        // Adds a new announce or replaces the one in the same slot of the
+        // same bot. Readers only see the change once it is published.
+        announce_id_t add(const std::string &bot_name, const std::string &channel, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count);
+
+        // Adds or replaces all announces of rows like add(), but publishes a
+        // single snapshot for all of them. Returns the number of rows added.
+        std::size_t add(const std::vector<AnnounceRow> &rows);
+
+        // Updates the download count and the time the current announce in
+        // slot of bot_name was last seen, like add() does for an announce
+        // that didn't change. Returns false if there is no such announce.
+        bool touch(const std::string &bot_name, std::uint16_t slot, std::uint32_t download_count, timestamp_t seen);
+
+        // Adds announces of an earlier run, unless their slot has been
+        // announced since. Returns the number of announces added.
+        std::size_t restore(const std::vector<AnnounceRow> &rows);
+
+        // Deletes all announces last seen before oldest, returns how many
+        std::size_t expire(timestamp_t oldest);
+
+        // Deletes the count announces seen least recently, older rows first
+        // among those seen at the same time
+        std::size_t evict(std::size_t count);
+
+        // Rebuilds the store without its deleted rows, so their memory is
+        // freed once no snapshot uses it anymore. Filenames of announces last
+        // seen before cold_before (if given) go to the cold tier, the others
+        // are stored uncompressed. Every row is copied, so unless forced this
+        // is only done if enough of them are deleted or to be compressed.
+        bool vacuum(bool force = false, timestamp_t cold_before = 0);
+
+        // Publishes the announces added since the last snapshot, returns
+        // false if there are none
+        bool flush();
+        std::size_t get_unpublished_count() const;
+
+        // Latest published snapshot, safe to call from any thread
+        AnnounceSnapshotPtr snapshot() const;
+
+        // ID the next new or changed announce gets
+        announce_id_t get_end_id() const;
+
+    private:
+        // Position of (bot_name, slot) in the key table, grows it if needed
+        std::size_t reserve_key(string_id_t bot_name, std::uint16_t slot);
+        std::size_t find_key(string_id_t bot_name, std::uint16_t slot) const;
+        void erase_key(std::size_t pos);
+
+        // add() without publishing the change
+        announce_id_t update(const AnnounceRow &row);
+        announce_id_t append(std::size_t key, string_id_t bot_name, string_id_t channel, StringRef filename, string_id_t size, std::uint16_t slot, std::uint32_t download_count, std::uint64_t num_size, timestamp_t seen);
+
+        // Adds a row with its filename stored already
+        announce_id_t append_row(std::size_t key, string_id_t bot_name, string_id_t channel, string_id_t filename, std::uint16_t filename_length, string_id_t size, std::uint16_t slot, std::uint32_t download_count, std::uint64_t num_size, timestamp_t seen, release_t release, string_id_t extension);
+
+        // Compresses the filenames of the rows of old in cold_ids into new
+        // cold filenames, cold_index[i] is set to the index of the filename
+        // of cold_ids[i] in them
+        static std::shared_ptr<FrontCodedStrings> build_cold_filenames(const AnnounceSnapshot &old, const std::vector<announce_id_t> &cold_ids, std::vector<string_id_t> &cold_index);
+
+        // Folded extension of filename, empty if it has none
+        string_id_t intern_extension(StringRef filename);
+        void grow_table();
+        void erase(announce_id_t id);
+        bool is_live(announce_id_t id) const;
+        StringRef get_filename(announce_id_t id, std::string &buffer) const;
+        StringRef get_folded_filename(announce_id_t id, std::string &buffer) const;
+
+        void seal_segment();
+        void publish();
+        std::size_t get_memory_usage() const;
+
+        bot_id_t bot_id;
+
+        // Columns
+        ChunkedColumn<string_id_t> bot_names;
+        ChunkedColumn<std::uint16_t> slots;
+        ChunkedColumn<std::atomic<std::uint32_t>> download_counts;
+        ChunkedColumn<string_id_t> sizes;
+        ChunkedColumn<std::uint64_t> num_sizes;
+        ChunkedColumn<string_id_t> filenames;
+        ChunkedColumn<std::uint16_t> filename_lengths;
+        ChunkedColumn<std::atomic<generation_t>> deleted;
+        ChunkedColumn<std::atomic<timestamp_t>> last_seen;
+        ChunkedColumn<release_t> releases;
+        ChunkedColumn<string_id_t> channels;
+        ChunkedColumn<string_id_t> extensions;
+
+        StringArena filename_arena;
+
+        // Every filename folded, so searches never have to fold them. Gets
+        // strings of the same lengths added in the same order as
+        // filename_arena, so a filename's ID is valid in both.
+        StringArena folded_filename_arena;
+
+        // Filenames of announces not seen for a while, replaced as a whole
+        // when the store is rebuilt
+        std::shared_ptr<const FrontCodedStrings> cold_filenames;
+
+        StringPool bot_name_pool;
+        StringPool size_pool;
+        StringPool channel_pool;
+        StringPool extension_pool;
+
+        // Open addressing hash table (bot, slot) => ID of the current announce
+        std::vector<announce_id_t> key_table;
+        std::size_t key_count;
+
+        std::vector<IndexSegmentPtr> segments;
+        announce_id_t indexed_end;
+
+        generation_t generation;
+        generation_t epoch;
+        announce_id_t published_end;
+        std::size_t live_count;
+        file_size_t total_size;
+        std::size_t expired_count;
+        std::size_t evicted_count;
+
+        // Only accessed through std::atomic_load/std::atomic_store
+        AnnounceSnapshotPtr current;
+};
+
+}
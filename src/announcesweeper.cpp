@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+
+#include "announcesweeper.h"
+#include "botmanager.h"
+
+namespace
+{
+    // Memory freed by deleting all announces of snapshot
+    std::size_t get_memory_usage(const xdccd::AnnounceSnapshot &snapshot)
+    {
+        return snapshot.get_memory_usage() + snapshot.get_index_memory_usage();
+    }
+
+    struct BotUsage
+    {
+        xdccd::DCCBotPtr bot;
+
+        // When the announces left were seen
+        std::vector<xdccd::timestamp_t> seen;
+
+        // Deleted rows use memory as well until they are vacuumed, so this
+        // is the same for all rows
+        double row_memory;
+        std::size_t evict;
+    };
+}
+
+xdccd::AnnounceLimits::AnnounceLimits()
+    : max_age(std::chrono::duration_cast<std::chrono::seconds>(xdccd::announcefile::MAX_AGE)), cold_age(0), max_bot_memory(0), max_memory(0)
+{
+}
+
+xdccd::AnnounceSweeper::AnnounceSweeper(BotManager &bot_manager)
+    : bot_manager(bot_manager), stop(false), thread(&AnnounceSweeper::run, this)
+{
+}
+
+xdccd::AnnounceSweeper::~AnnounceSweeper()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+
+    wake.notify_all();
+    thread.join();
+}
+
+void xdccd::AnnounceSweeper::set_limits(const AnnounceLimits &limits)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    this->limits = limits;
+}
+
+xdccd::AnnounceLimits xdccd::AnnounceSweeper::get_limits()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return limits;
+}
+
+void xdccd::AnnounceSweeper::sweep()
+{
+    AnnounceLimits current = get_limits();
+
+    timestamp_t now = xdccd::store::now();
+    timestamp_t expire_before = 0;
+    if (current.max_age.count() > 0 && now > current.max_age.count())
+        expire_before = static_cast<timestamp_t>(now - current.max_age.count());
+
+    timestamp_t cold_before = 0;
+    if (current.cold_age.count() > 0 && now > current.cold_age.count())
+        cold_before = static_cast<timestamp_t>(now - current.cold_age.count());
+
+    std::vector<BotUsage> usages;
+    for (auto &bot : bot_manager.get_bots())
+    {
+        AnnounceSnapshotPtr snapshot = bot->get_announces();
+
+        BotUsage usage;
+        usage.bot = bot;
+        usage.row_memory = snapshot->get_end_id() ? static_cast<double>(get_memory_usage(*snapshot)) / snapshot->get_end_id() : 0.0;
+        usage.evict = 0;
+
+        if (current.max_bot_memory || current.max_memory)
+        {
+            // Expired announces are gone anyway
+            snapshot->get_last_seen(usage.seen);
+            usage.seen.erase(std::remove_if(usage.seen.begin(), usage.seen.end(), [expire_before](timestamp_t seen) { return seen < expire_before; }), usage.seen.end());
+        }
+
+        if (current.max_bot_memory && usage.seen.size() * usage.row_memory > current.max_bot_memory)
+        {
+            std::size_t keep = static_cast<std::size_t>(current.max_bot_memory / usage.row_memory);
+            usage.evict = usage.seen.size() - keep;
+
+            std::nth_element(usage.seen.begin(), usage.seen.begin() + usage.evict, usage.seen.end());
+            usage.seen.erase(usage.seen.begin(), usage.seen.begin() + usage.evict);
+        }
+
+        usages.push_back(std::move(usage));
+    }
+
+    double total_memory = 0.0;
+    for (auto &usage : usages)
+        total_memory += usage.seen.size() * usage.row_memory;
+
+    if (current.max_memory && total_memory > current.max_memory)
+    {
+        // The announces seen least recently go first, no matter which bot
+        // they belong to
+        std::vector<std::pair<timestamp_t, std::size_t>> rows;
+        for (std::size_t i = 0; i < usages.size(); ++i)
+        {
+            for (timestamp_t seen : usages[i].seen)
+                rows.emplace_back(seen, i);
+        }
+
+        std::sort(rows.begin(), rows.end());
+
+        for (auto &row : rows)
+        {
+            if (total_memory <= current.max_memory)
+                break;
+
+            BotUsage &usage = usages[row.second];
+            usage.evict++;
+            total_memory -= usage.row_memory;
+        }
+    }
+
+    for (auto &usage : usages)
+        usage.bot->sweep_announces(expire_before, cold_before, usage.evict);
+}
+
+void xdccd::AnnounceSweeper::run()
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    for (;;)
+    {
+        if (wake.wait_for(guard, xdccd::sweeper::INTERVAL, [this]() { return stop; }))
+            return;
+
+        guard.unlock();
+
+        try
+        {
+            sweep();
+        }
+        catch (const std::exception &e)
+        {
+            BOOST_LOG_TRIVIAL(error) << "Sweeping announces failed: " << e.what();
+        }
+
+        guard.lock();
+    }
+}
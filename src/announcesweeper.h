@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "dccbot.h"
+
+namespace xdccd
+{
+
+namespace sweeper
+{
+// Interval between two sweeps over the announces of all bots
+static const std::chrono::minutes INTERVAL(5);
+}
+
+// Bounds on the announces kept in memory, zero means unbounded
+struct AnnounceLimits
+{
+    AnnounceLimits();
+
+    // Announces not seen for this long are expired
+    std::chrono::seconds max_age;
+
+    // Filenames of announces not seen for this long are kept compressed
+    std::chrono::seconds cold_age;
+
+    // In bytes, per bot and for all bots together. The announces seen least
+    // recently are evicted first.
+    std::size_t max_bot_memory;
+    std::size_t max_memory;
+};
+
+class BotManager;
+
+// Periodically deletes the announces of all bots that are out of their
+// limits. Only decides what to delete, bots delete it on their own thread.
+class AnnounceSweeper
+{
+    public:
+        AnnounceSweeper(BotManager &bot_manager);
+        ~AnnounceSweeper();
+
+        AnnounceSweeper(const AnnounceSweeper&) = delete;
+        AnnounceSweeper &operator=(const AnnounceSweeper&) = delete;
+
+        void set_limits(const AnnounceLimits &limits);
+        AnnounceLimits get_limits();
+
+        void sweep();
+
+    private:
+        void run();
+
+        BotManager &bot_manager;
+        AnnounceLimits limits;
+
+        std::mutex lock;
+        std::condition_variable wake;
+        bool stop;
+
+        // Last member, so it is only started once everything it uses is there
+        std::thread thread;
+};
+
+}
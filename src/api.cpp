@@ -15,6 +15,103 @@ using namespace std::chrono_literals;
 
 bool xdccd::API::quit = false;
 
+namespace
+{
+    void close_with_json(std::shared_ptr<restbed::Session> session, int status, const Json::Value &root)
+    {
+        std::ostringstream oss;
+        oss << root;
+        std::string result = oss.str();
+        session->close(status, result, { { "Content-Length", std::to_string(result.size()) }, { "Content-Type", "application/json" } });
+    }
+
+    // Query parameter holding a count, default_value if it is missing or no number
+    std::size_t get_count_parameter(const restbed::Request &request, const std::string &name, std::size_t default_value)
+    {
+        try
+        {
+            return std::stoull(request.get_query_parameter(name, std::to_string(default_value)));
+        }
+        catch (const std::exception &)
+        {
+            return default_value;
+        }
+    }
+
+    void parse_search_filters(const Json::Value &filters, xdccd::SearchOptions &options)
+    {
+        xdccd::AnnounceFilter &filter = options.filter;
+
+        // Sizes are given like in announces ("700M", "1.4G") or in KiB
+        if (filters.isMember("min_size"))
+            filter.min_size = xdccd::store::parse_size(filters["min_size"].asString());
+
+        if (filters.isMember("max_size"))
+            filter.max_size = xdccd::store::parse_size(filters["max_size"].asString());
+
+        if (filters.isMember("min_downloads"))
+            filter.min_downloads = filters["min_downloads"].asUInt();
+
+        // In seconds
+        if (filters.isMember("max_age"))
+            filter.max_age = filters["max_age"].asUInt();
+
+        for (auto &name : filters["bots"])
+            filter.bot_names.push_back(name.asString());
+
+        for (auto &channel : filters["channels"])
+            filter.channels.push_back(channel.asString());
+
+        for (auto &extension : filters["extensions"])
+            filter.extensions.push_back(extension.asString());
+
+        for (auto &network : filters["networks"])
+            options.networks.push_back(network.asString());
+    }
+
+    void append_search_results(const xdccd::SearchResult &sr, Json::Value &root)
+    {
+        root["total_results"] = static_cast<Json::UInt64>(sr.total_results);
+        root["start"] = static_cast<Json::UInt64>(sr.result_start);
+
+        Json::Value result_list(Json::ValueType::arrayValue);
+        for (auto it = sr.begin; it != sr.end; ++it)
+        {
+            Json::Value child;
+            xdccd::DCCAnnouncePtr announce = sr.results->get(*it);
+
+            child["bot_id"] = static_cast<Json::UInt64>(announce->bot_id);
+            child["name"] = announce->filename;
+            child["size"] = announce->size;
+            child["download_count"] = announce->download_count;
+            child["bot"] = announce->bot_name;
+            child["channel"] = announce->channel;
+            child["slot"] = announce->slot;
+            child["score"] = it->score;
+            child["source_count"] = static_cast<Json::UInt64>(it->sources.size());
+
+            // Every bot offering the same release
+            Json::Value sources(Json::ValueType::arrayValue);
+            for (auto &source : it->sources)
+            {
+                xdccd::DCCAnnouncePtr copy = sr.results->get(source);
+
+                Json::Value source_child;
+                source_child["bot_id"] = static_cast<Json::UInt64>(copy->bot_id);
+                source_child["bot"] = copy->bot_name;
+                source_child["slot"] = copy->slot;
+                source_child["download_count"] = copy->download_count;
+                sources.append(source_child);
+            }
+
+            child["sources"] = sources;
+            result_list.append(child);
+        }
+
+        root["results"] = result_list;
+    }
+}
+
 xdccd::API::API(const std::string &bind_address, int port, const boost::filesystem::path &download_path, bool enable_webinterface)
     : bind_address(bind_address),
 	port(port),
@@ -93,7 +190,7 @@ void xdccd::API::status_handler(std::shared_ptr<restbed::Session> session)
         child["botname"] = bot->get_nickname();
         child["connection_state"] = bot->get_connection_state();
         child["host"] = bot->get_host() + ":" + bot->get_port();
-        child["announces"] = static_cast<Json::UInt64>(bot->get_announces().size());
+        child["announces"] = static_cast<Json::UInt64>(bot->get_announces()->size());
         child["total_size"] = static_cast<Json::UInt64>(bot->get_total_announces_size());
 
         Json::Value request_list(Json::ValueType::arrayValue);
@@ -165,6 +262,110 @@ void xdccd::API::status_handler(std::shared_ptr<restbed::Session> session)
     session->close(restbed::OK, result, { { "Content-Length", std::to_string(result.size()) }, { "Content-Type", "application/json" } });
 }
 
+void xdccd::API::stats_handler(std::shared_ptr<restbed::Session> session)
+{
+    Json::Value root;
+
+    Json::Value tls_list(Json::ValueType::arrayValue);
+    for (auto &context : bot_manager.get_ssl_context_manager().get_contexts())
+    {
+        const xdccd::TLSStats &stats = context->get_stats();
+        std::size_t handshakes = stats.handshakes;
+        std::size_t resumed = stats.resumed;
+
+        Json::Value child;
+        child["network"] = context->get_host() + ":" + context->get_port();
+        child["handshakes"] = static_cast<Json::UInt64>(handshakes);
+        child["resumed"] = static_cast<Json::UInt64>(resumed);
+        child["failed"] = static_cast<Json::UInt64>(stats.failed);
+        child["cached_sessions"] = static_cast<Json::UInt64>(context->get_cached_sessions());
+        child["resumption_rate"] = handshakes ? static_cast<double>(resumed) / handshakes : 0.0;
+        child["avg_handshake_ms"] = handshakes ? stats.handshake_time_us / 1000.0 / handshakes : 0.0;
+        tls_list.append(child);
+    }
+    root["tls"] = tls_list;
+
+    Json::Value network_list(Json::ValueType::arrayValue);
+    for (auto &network : bot_manager.get_connection_scheduler().get_stats())
+    {
+        Json::Value child;
+        child["host"] = network.host;
+        child["connecting"] = static_cast<Json::UInt64>(network.connecting);
+        child["waiting"] = static_cast<Json::UInt64>(network.waiting);
+        child["connection_attempts"] = static_cast<Json::UInt64>(network.granted);
+        network_list.append(child);
+    }
+    root["networks"] = network_list;
+
+    // Commands received by all bots
+    std::map<xdccd::irc::Command, xdccd::CommandStats> commands;
+    for (auto &bot : bot_manager.get_bots())
+    {
+        for (auto &stats : bot->get_dispatcher().get_stats())
+        {
+            auto it = commands.insert(std::make_pair(stats.command, xdccd::CommandStats{stats.command, 0, 0})).first;
+            it->second.count += stats.count;
+            it->second.handler_time_ns += stats.handler_time_ns;
+        }
+    }
+
+    Json::Value command_list(Json::ValueType::objectValue);
+    for (auto &command : commands)
+    {
+        Json::Value child;
+        child["count"] = static_cast<Json::UInt64>(command.second.count);
+        child["avg_handler_us"] = command.second.handler_time_ns / 1000.0 / command.second.count;
+        command_list[xdccd::irc::command_name(command.first)] = child;
+    }
+    root["commands"] = command_list;
+
+    std::size_t tokens = 0, trigrams = 0, segments = 0, index_memory = 0, announces = 0, store_memory = 0, expired = 0, evicted = 0;
+    for (auto &bot : bot_manager.get_bots())
+    {
+        AnnounceSnapshotPtr snapshot = bot->get_announces();
+        tokens += snapshot->get_token_count();
+        trigrams += snapshot->get_trigram_count();
+        segments += snapshot->get_segment_count();
+        index_memory += snapshot->get_index_memory_usage();
+        announces += snapshot->size();
+        store_memory += snapshot->get_memory_usage();
+        expired += snapshot->get_expired_count();
+        evicted += snapshot->get_evicted_count();
+    }
+
+    root["index"]["tokens"] = static_cast<Json::UInt64>(tokens);
+    root["index"]["trigrams"] = static_cast<Json::UInt64>(trigrams);
+    root["index"]["segments"] = static_cast<Json::UInt64>(segments);
+    root["index"]["memory"] = static_cast<Json::UInt64>(index_memory);
+    root["index"]["substring_kernel"] = substring_kernel_name();
+    root["store"]["announces"] = static_cast<Json::UInt64>(announces);
+    root["store"]["memory"] = static_cast<Json::UInt64>(store_memory);
+    root["store"]["expired"] = static_cast<Json::UInt64>(expired);
+    root["store"]["evicted"] = static_cast<Json::UInt64>(evicted);
+
+    SearchCacheStats cache = search_manager.get_stats();
+    std::size_t lookups = cache.hits + cache.misses;
+    root["search_cache"]["entries"] = static_cast<Json::UInt64>(cache.entries);
+    root["search_cache"]["memory"] = static_cast<Json::UInt64>(cache.memory);
+    root["search_cache"]["hits"] = static_cast<Json::UInt64>(cache.hits);
+    root["search_cache"]["misses"] = static_cast<Json::UInt64>(cache.misses);
+    root["search_cache"]["hit_ratio"] = lookups ? static_cast<double>(cache.hits) / lookups : 0.0;
+    root["search_cache"]["invalidations"] = static_cast<Json::UInt64>(cache.invalidations);
+    root["search_cache"]["evictions"] = static_cast<Json::UInt64>(cache.evictions);
+    root["search_cache"]["negative_entries"] = static_cast<Json::UInt64>(cache.negative_entries);
+    root["search_cache"]["negative_hits"] = static_cast<Json::UInt64>(cache.negative_hits);
+    root["search_jobs"]["running"] = static_cast<Json::UInt64>(search_manager.get_running_jobs());
+    root["watch_list"]["rules"] = static_cast<Json::UInt64>(bot_manager.get_watch_list().get_rules().size());
+    root["watch_list"]["downloaded"] = static_cast<Json::UInt64>(bot_manager.get_watch_list().get_downloaded_count());
+
+    std::ostringstream oss;
+    oss << root;
+
+    std::string result = oss.str();
+
+    session->close(restbed::OK, result, { { "Content-Length", std::to_string(result.size()) }, { "Content-Type", "application/json" } });
+}
+
 void xdccd::API::connect_handler(std::shared_ptr<restbed::Session> session)
 {
     const auto request = session->get_request();
@@ -304,7 +505,9 @@ void xdccd::API::search_handler(std::shared_ptr<restbed::Session> session)
             return;
         }
 
-        if (!search_request.isMember("query") || search_request["query"].asString().empty())
+        // Filters alone list every announce passing them
+        bool filtered = search_request.isMember("filters") && search_request["filters"].isObject();
+        if ((!search_request.isMember("query") || search_request["query"].asString().empty()) && !filtered)
         {
             session->close(restbed::UNPROCESSABLE_ENTITY);
             return;
@@ -318,39 +521,143 @@ void xdccd::API::search_handler(std::shared_ptr<restbed::Session> session)
         if (search_request.isMember("limit"))
             limit = search_request["limit"].asUInt64();
 
+        xdccd::SearchOptions options;
+        if (search_request.isMember("fuzzy"))
+            options.fuzzy = search_request["fuzzy"].asBool();
+
+        if (filtered)
+            parse_search_filters(search_request["filters"], options);
+
         // Build response
         Json::Value root;
 
-        xdccd::SearchResultPtr sr = search_manager.search(bot_manager, search_request["query"].asString(), start, limit);
+        // Runs in the background, the results are polled from /search/<id>
+        if (search_request.get("async", false).asBool())
+        {
+            xdccd::SearchJobPtr job = search_manager.submit(bot_manager, search_request["query"].asString(), start + limit, options);
+            if (!job)
+            {
+                session->close(restbed::SERVICE_UNAVAILABLE);
+                return;
+            }
 
-        root["total_results"] = static_cast<Json::UInt64>(sr->total_results);
-        root["start"] = static_cast<Json::UInt64>(sr->result_start);
+            root["id"] = static_cast<Json::UInt64>(job->get_id());
+            root["state"] = xdccd::search::job_state_name(job->get_state());
 
-        Json::Value result_list(Json::ValueType::arrayValue);
-        for (auto it = sr->begin; it != sr->end; ++it)
+            close_with_json(session, restbed::ACCEPTED, root);
+            return;
+        }
+
+        xdccd::SearchResultPtr sr = search_manager.search(bot_manager, search_request["query"].asString(), start, limit, options);
+        append_search_results(*sr, root);
+
+        close_with_json(session, restbed::OK, root);
+    });
+}
+
+void xdccd::API::search_job_handler(std::shared_ptr<restbed::Session> session)
+{
+    const auto request = session->get_request();
+    const std::string id = request->get_path_parameter("id");
+    xdccd::SearchJobPtr job = search_manager.get_job(std::stoull(id));
+
+    if (job == nullptr)
+    {
+        session->close(restbed::NOT_FOUND);
+        return;
+    }
+
+    std::size_t start = get_count_parameter(*request, "start", 0);
+    std::size_t limit = get_count_parameter(*request, "limit", xdccd::search::RESULTS_PER_PAGE);
+
+    // State first, results published after it are only more complete
+    Json::Value root;
+    root["id"] = static_cast<Json::UInt64>(job->get_id());
+    root["state"] = xdccd::search::job_state_name(job->get_state());
+    root["shards"] = static_cast<Json::UInt64>(job->get_shards());
+    root["finished_shards"] = static_cast<Json::UInt64>(job->get_finished_shards());
+
+    xdccd::SearchResult sr(job->get_results(), start, limit);
+    append_search_results(sr, root);
+
+    close_with_json(session, restbed::OK, root);
+}
+
+void xdccd::API::cancel_search_handler(std::shared_ptr<restbed::Session> session)
+{
+    const auto request = session->get_request();
+    const std::string id = request->get_path_parameter("id");
+    xdccd::SearchJobPtr job = search_manager.get_job(std::stoull(id));
+
+    if (job == nullptr)
+    {
+        session->close(restbed::NOT_FOUND);
+        return;
+    }
+
+    job->cancel();
+
+    session->close(restbed::OK);
+}
+
+void xdccd::API::watch_list_handler(std::shared_ptr<restbed::Session> session)
+{
+    Json::Value root;
+    root["rules"] = Json::Value(Json::ValueType::arrayValue);
+
+    for (auto &rule : bot_manager.get_watch_list().get_rules())
+        root["rules"].append(rule.to_json());
+
+    close_with_json(session, restbed::OK, root);
+}
+
+void xdccd::API::add_watch_rule_handler(std::shared_ptr<restbed::Session> session)
+{
+    const auto request = session->get_request();
+
+    int content_length = 0;
+    request->get_header("Content-Length", content_length);
+
+    session->fetch(content_length, [this](const std::shared_ptr<restbed::Session> session, const restbed::Bytes& body)
+    {
+        Json::Value root;
+        Json::Reader reader;
+
+        std::string data(body.begin(), body.end());
+        if (!reader.parse(data.c_str(), root))
         {
-            Json::Value child;
-            DCCAnnouncePtr announce = (*it)->announce;
+            session->close(restbed::UNPROCESSABLE_ENTITY);
+            return;
+        }
 
-            child["bot_id"] = static_cast<Json::UInt64>(announce->bot_id);
-            child["name"] = announce->filename;
-            child["size"] = announce->size;
-            child["download_count"] = announce->download_count;
-            child["bot"] = announce->bot_name;
-            child["slot"] = announce->slot;
-            child["score"] = (*it)->score;
-            result_list.append(child);
+        // Same filters as for searching, but only those that apply to new announces
+        xdccd::WatchRule rule;
+        if (!xdccd::WatchRule::from_json(root, rule))
+        {
+            session->close(restbed::UNPROCESSABLE_ENTITY);
+            return;
         }
 
-        root["results"] = result_list;
+        rule.id = bot_manager.get_watch_list().add(rule);
 
-        std::ostringstream oss;
-        oss << root;
-        std::string result = oss.str();
-        session->close(restbed::OK, result, { { "Content-Length", std::to_string(result.size()) }, { "Content-Type", "application/json" } });
+        close_with_json(session, restbed::OK, rule.to_json());
     });
 }
 
+void xdccd::API::remove_watch_rule_handler(std::shared_ptr<restbed::Session> session)
+{
+    const auto request = session->get_request();
+    const std::string id = request->get_path_parameter("id");
+
+    if (!bot_manager.get_watch_list().remove(static_cast<xdccd::watch_rule_id_t>(std::stoul(id))))
+    {
+        session->close(restbed::NOT_FOUND);
+        return;
+    }
+
+    session->close(restbed::OK);
+}
+
 void xdccd::API::shutdown_handler(std::shared_ptr<restbed::Session> session)
 {
     session->close(restbed::OK);
@@ -381,6 +688,12 @@ void xdccd::API::run()
     resource->set_method_handler("GET", { { "Content-Type", "application/json" } }, std::bind(&API::status_handler, this, std::placeholders::_1));
     service.publish(resource);
 
+    // Stats
+    resource = std::make_shared<restbed::Resource>();
+    resource->set_path("/stats");
+    resource->set_method_handler("GET", { { "Content-Type", "application/json" } }, std::bind(&API::stats_handler, this, std::placeholders::_1));
+    service.publish(resource);
+
     // Connect
     resource = std::make_shared<restbed::Resource>();
     resource->set_path("/connect");
@@ -401,6 +714,31 @@ void xdccd::API::run()
     resource->set_method_handler("OPTIONS", [](std::shared_ptr<restbed::Session> session) { session->close(restbed::OK, ""); } );
     service.publish(resource);
 
+    resource = std::make_shared<restbed::Resource>();
+    resource->set_path("/search/{id: [0-9]+}");
+    resource->set_method_handler("GET", { { "Content-Type", "application/json" } }, std::bind(&API::search_job_handler, this, std::placeholders::_1));
+    service.publish(resource);
+
+    resource = std::make_shared<restbed::Resource>();
+    resource->set_path("/search/{id: [0-9]+}/cancel");
+    resource->set_method_handler("POST", { { "Content-Type", "application/json" } }, std::bind(&API::cancel_search_handler, this, std::placeholders::_1));
+    resource->set_method_handler("OPTIONS", [](std::shared_ptr<restbed::Session> session) { session->close(restbed::OK, ""); } );
+    service.publish(resource);
+
+    // Watch list
+    resource = std::make_shared<restbed::Resource>();
+    resource->set_path("/watchlist");
+    resource->set_method_handler("GET", { { "Content-Type", "application/json" } }, std::bind(&API::watch_list_handler, this, std::placeholders::_1));
+    resource->set_method_handler("POST", { { "Content-Type", "application/json" } }, std::bind(&API::add_watch_rule_handler, this, std::placeholders::_1));
+    resource->set_method_handler("OPTIONS", [](std::shared_ptr<restbed::Session> session) { session->close(restbed::OK, ""); } );
+    service.publish(resource);
+
+    resource = std::make_shared<restbed::Resource>();
+    resource->set_path("/watchlist/{id: [0-9]+}/delete");
+    resource->set_method_handler("POST", { { "Content-Type", "application/json" } }, std::bind(&API::remove_watch_rule_handler, this, std::placeholders::_1));
+    resource->set_method_handler("OPTIONS", [](std::shared_ptr<restbed::Session> session) { session->close(restbed::OK, ""); } );
+    service.publish(resource);
+
     // Request File
     resource = std::make_shared<restbed::Resource>();
     resource->set_path("/bot/{id: [0-9]+}/request/");
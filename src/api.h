@@ -29,11 +29,17 @@ class API
 
         // Resource handlers
         void status_handler(std::shared_ptr<restbed::Session> session);
+        void stats_handler(std::shared_ptr<restbed::Session> session);
         void connect_handler(std::shared_ptr<restbed::Session> session);
         void disconnect_handler(std::shared_ptr<restbed::Session> session);
         void remove_file_from_list_handler(std::shared_ptr<restbed::Session> session);
         void request_file_handler(std::shared_ptr<restbed::Session> session);
         void search_handler(std::shared_ptr<restbed::Session> session);
+        void search_job_handler(std::shared_ptr<restbed::Session> session);
+        void cancel_search_handler(std::shared_ptr<restbed::Session> session);
+        void watch_list_handler(std::shared_ptr<restbed::Session> session);
+        void add_watch_rule_handler(std::shared_ptr<restbed::Session> session);
+        void remove_watch_rule_handler(std::shared_ptr<restbed::Session> session);
         void shutdown_handler(std::shared_ptr<restbed::Session> session);
 
     private:
@@ -3,7 +3,7 @@
 #include "botmanager.h"
 
 xdccd::BotManager::BotManager(ThreadManager &thread_man, std::size_t max_bots)
-    : max_bots(max_bots), last_bot_id(0), thread_manager(thread_man)
+    : max_bots(max_bots), last_bot_id(0), thread_manager(thread_man), announce_sweeper(*this)
 {}
 
 xdccd::BotManager::~BotManager()
@@ -13,15 +13,20 @@ xdccd::BotManager::~BotManager()
         bot->stop();
 }
 
-void xdccd::BotManager::launch_bot(const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, bool use_ssl, DownloadManager &download_manager)
+xdccd::DCCBotPtr xdccd::BotManager::launch_bot(const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, bool use_ssl, DownloadManager &download_manager)
 {
-    DCCBotPtr bot = std::make_shared<DCCBot>(last_bot_id++, host, port, nick, channels, use_ssl, download_manager);
+    // Bots connecting to the same network share their SSL context (and session cache)
+    SSLContextPtr ssl_context = use_ssl ? ssl_context_manager.get_context(host, port) : nullptr;
+    DCCBotPtr bot = std::make_shared<DCCBot>(last_bot_id++, host, port, nick, channels, ssl_context, connection_scheduler, download_manager);
+    bot->set_watch_list(watch_list);
 
     BOOST_LOG_TRIVIAL(info) << "Launching bot " << bot;
 
     thread_manager.run([bot]() { bot->run(); });
     std::lock_guard<std::mutex> lock(bots_lock);
     bots.push_back(bot);
+
+    return bot;
 }
 
 std::vector<xdccd::DCCBotPtr> xdccd::BotManager::get_bots()
@@ -52,3 +57,23 @@ void xdccd::BotManager::stop_bot(xdccd::DCCBotPtr bot)
     std::lock_guard<std::mutex> lock(bots_lock);
     bots.erase(std::remove(bots.begin(), bots.end(), bot));
 }
+
+xdccd::SSLContextManager &xdccd::BotManager::get_ssl_context_manager()
+{
+    return ssl_context_manager;
+}
+
+xdccd::ConnectionScheduler &xdccd::BotManager::get_connection_scheduler()
+{
+    return connection_scheduler;
+}
+
+xdccd::AnnounceSweeper &xdccd::BotManager::get_announce_sweeper()
+{
+    return announce_sweeper;
+}
+
+xdccd::WatchList &xdccd::BotManager::get_watch_list()
+{
+    return watch_list;
+}
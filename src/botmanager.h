@@ -4,6 +4,9 @@
 
 #include "threadmanager.h"
 #include "dccbot.h"
+#include "sslcontext.h"
+#include "announcesweeper.h"
+#include "watchlist.h"
 
 namespace xdccd
 {
@@ -13,18 +16,31 @@ class BotManager
     public:
         BotManager(ThreadManager &thread_man, std::size_t max_bots);
         ~BotManager();
-        void launch_bot(const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, bool use_ssl, DownloadManager &download_manager);
+        DCCBotPtr launch_bot(const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, bool use_ssl, DownloadManager &download_manager);
         void run();
         std::vector<DCCBotPtr> get_bots();
         DCCBotPtr get_bot_by_id(bot_id_t id);
         void stop_bot(DCCBotPtr bot);
+        SSLContextManager &get_ssl_context_manager();
+        ConnectionScheduler &get_connection_scheduler();
+        AnnounceSweeper &get_announce_sweeper();
+        WatchList &get_watch_list();
 
     private:
         std::size_t max_bots;
         std::size_t last_bot_id;
         ThreadManager &thread_manager;
+
+        // Declared before the bots, which use them until they are destroyed
+        SSLContextManager ssl_context_manager;
+        ConnectionScheduler connection_scheduler;
+        WatchList watch_list;
+
         std::vector<DCCBotPtr> bots;
         std::mutex bots_lock;
+
+        // Declared after the bots, so it stops sweeping them first
+        AnnounceSweeper announce_sweeper;
 };
 
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "buffertarget.h"
 
 xdccd::BufferTarget::BufferTarget(file_id_t id, const std::string &filename, file_size_t size)
@@ -7,6 +9,7 @@ xdccd::BufferTarget::BufferTarget(file_id_t id, const std::string &filename, fil
 
 void xdccd::BufferTarget::open()
 {
+    data.clear();
 }
 
 void xdccd::BufferTarget::close()
@@ -15,9 +18,20 @@ void xdccd::BufferTarget::close()
 
 void xdccd::BufferTarget::write(const char* data, std::streamsize len)
 {
+    // Never keep more than the sender announced, however much it sends
+    std::streamsize left = size - static_cast<file_size_t>(this->data.size());
+    if (left <= 0)
+        return;
+
+    this->data.append(data, static_cast<std::size_t>(std::min(len, left)));
 }
 
 int xdccd::BufferTarget::read()
 {
     return 0;
 }
+
+const std::string &xdccd::BufferTarget::get_data() const
+{
+    return data;
+}
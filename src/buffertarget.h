@@ -1,10 +1,14 @@
 #pragma once
 
+#include <string>
+
 #include "abstracttarget.h"
 
 namespace xdccd
 {
 
+// Receives a file into memory, for files we only want to read, like the
+// pack lists of bots
 class BufferTarget : public AbstractTarget
 {
     public:
@@ -14,7 +18,12 @@ class BufferTarget : public AbstractTarget
         void write(const char* data, std::streamsize len);
         int read();
 
+        // Everything received so far. Only safe to use once the download
+        // has finished.
+        const std::string &get_data() const;
+
     private:
+        std::string data;
 };
 
 typedef std::shared_ptr<BufferTarget> BufferTargetPtr;
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace xdccd
+{
+
+namespace column
+{
+static const std::size_t CHUNK_SHIFT(12);
+static const std::size_t CHUNK_SIZE(1 << CHUNK_SHIFT);
+}
+
+// Column of a struct-of-arrays table, allocated in fixed size chunks so
+// elements never move. Views share the chunks with the column and stay
+// readable from other threads while the owning thread keeps appending.
+template <typename T>
+class ChunkedColumn
+{
+    public:
+        typedef std::array<T, column::CHUNK_SIZE> chunk_t;
+        typedef std::vector<std::shared_ptr<chunk_t>> directory_t;
+
+        // Read-only view of the first size() elements of a column
+        class View
+        {
+            public:
+                View()
+                    : count(0)
+                {}
+
+                View(std::shared_ptr<const directory_t> chunks, std::size_t count)
+                    : chunks(chunks), count(count)
+                {}
+
+                const T &operator[](std::size_t i) const
+                {
+                    return (*(*chunks)[i >> column::CHUNK_SHIFT])[i & (column::CHUNK_SIZE - 1)];
+                }
+
+                std::size_t size() const
+                {
+                    return count;
+                }
+
+            private:
+                std::shared_ptr<const directory_t> chunks;
+                std::size_t count;
+        };
+
+        ChunkedColumn()
+            : chunks(std::make_shared<directory_t>()), count(0)
+        {}
+
+        template <typename U>
+        void push_back(U value)
+        {
+            if ((count & (column::CHUNK_SIZE - 1)) == 0)
+            {
+                // Never grow a directory views might be reading, replace it
+                auto grown = std::make_shared<directory_t>(*chunks);
+                grown->push_back(std::make_shared<chunk_t>());
+                chunks = grown;
+            }
+
+            (*chunks->back())[count & (column::CHUNK_SIZE - 1)] = value;
+            count++;
+        }
+
+        T &operator[](std::size_t i)
+        {
+            return (*(*chunks)[i >> column::CHUNK_SHIFT])[i & (column::CHUNK_SIZE - 1)];
+        }
+
+        const T &operator[](std::size_t i) const
+        {
+            return (*(*chunks)[i >> column::CHUNK_SHIFT])[i & (column::CHUNK_SIZE - 1)];
+        }
+
+        std::size_t size() const
+        {
+            return count;
+        }
+
+        View view() const
+        {
+            return View(chunks, count);
+        }
+
+        std::size_t get_memory_usage() const
+        {
+            return chunks->size() * sizeof(chunk_t) + chunks->capacity() * sizeof(std::shared_ptr<chunk_t>);
+        }
+
+    private:
+        std::shared_ptr<directory_t> chunks;
+        std::size_t count;
+};
+
+}
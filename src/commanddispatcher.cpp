@@ -0,0 +1,51 @@
+#include <chrono>
+
+#include "commanddispatcher.h"
+
+xdccd::CommandDispatcher::CommandDispatcher()
+{
+    for (auto &counter : counters)
+    {
+        counter.count = 0;
+        counter.handler_time_ns = 0;
+    }
+}
+
+void xdccd::CommandDispatcher::register_handler(irc::Command command, const command_handler_t &handler)
+{
+    handlers[command].push_back(handler);
+}
+
+void xdccd::CommandDispatcher::dispatch(const IRCMessage &msg)
+{
+    Counter &counter = counters[msg.code];
+    counter.count.fetch_add(1, std::memory_order_relaxed);
+
+    const auto &command_handlers = handlers[msg.code];
+    if (command_handlers.empty())
+        return;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (auto &handler : command_handlers)
+        handler(msg);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    counter.handler_time_ns.fetch_add(elapsed.count(), std::memory_order_relaxed);
+}
+
+std::vector<xdccd::CommandStats> xdccd::CommandDispatcher::get_stats() const
+{
+    std::vector<CommandStats> result;
+
+    for (std::size_t i = 0; i < counters.size(); ++i)
+    {
+        std::size_t count = counters[i].count.load(std::memory_order_relaxed);
+        if (count == 0)
+            continue;
+
+        result.push_back(CommandStats{static_cast<irc::Command>(i), count, counters[i].handler_time_ns.load(std::memory_order_relaxed)});
+    }
+
+    return result;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "ircmessage.h"
+
+namespace xdccd
+{
+
+typedef std::function<void (const IRCMessage&)> command_handler_t;
+
+struct CommandStats
+{
+    irc::Command command;
+    std::size_t count;
+    std::size_t handler_time_ns;
+};
+
+// Dispatches parsed IRC messages to the handlers registered for their
+// command, while counting messages and time spent in the handlers
+class CommandDispatcher
+{
+    public:
+        CommandDispatcher();
+
+        // Handlers are called in the order they were registered
+        void register_handler(irc::Command command, const command_handler_t &handler);
+        void dispatch(const IRCMessage &msg);
+
+        // Returns the stats of all commands received at least once
+        std::vector<CommandStats> get_stats() const;
+
+    private:
+        struct Counter
+        {
+            std::atomic<std::size_t> count;
+            std::atomic<std::size_t> handler_time_ns;
+        };
+
+        std::array<std::vector<command_handler_t>, irc::COMMAND_COUNT> handlers;
+        std::array<Counter, irc::COMMAND_COUNT> counters;
+};
+
+}
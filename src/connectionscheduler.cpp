@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <boost/log/trivial.hpp>
+
+#include "connectionscheduler.h"
+#include "ircconnection.h"
+
+xdccd::ConnectionScheduler::Network::Network()
+    : connecting(0), granted(0)
+{}
+
+xdccd::ConnectionScheduler::ConnectionScheduler(std::size_t max_concurrent)
+    : max_concurrent(max_concurrent), last_ticket(0), random(std::random_device()())
+{}
+
+xdccd::connect_ticket_t xdccd::ConnectionScheduler::request(const std::string &host, const priority_handler_t &priority, const grant_handler_t &grant)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    connect_ticket_t ticket = ++last_ticket;
+    Network &network = networks[host];
+
+    if (network.connecting >= max_concurrent)
+    {
+        BOOST_LOG_TRIVIAL(debug) << "Delaying connection to " << host << ", " << network.connecting << " connection attempts already running.";
+        network.waiting.push_back(Waiter{ticket, priority, grant});
+        return ticket;
+    }
+
+    network.connecting++;
+    network.granted++;
+    guard.unlock();
+
+    grant();
+    return ticket;
+}
+
+void xdccd::ConnectionScheduler::release(const std::string &host)
+{
+    std::unique_lock<std::mutex> guard(lock);
+
+    Network &network = networks[host];
+    if (network.connecting > 0)
+        network.connecting--;
+
+    if (network.waiting.empty())
+        return;
+
+    // Bots with pending requests or running transfers come first, ties are
+    // served in arrival order
+    auto next = network.waiting.begin();
+    int next_priority = next->priority ? next->priority() : 0;
+
+    for (auto it = std::next(next); it != network.waiting.end(); ++it)
+    {
+        int priority = it->priority ? it->priority() : 0;
+        if (priority > next_priority)
+        {
+            next = it;
+            next_priority = priority;
+        }
+    }
+
+    grant_handler_t grant = next->grant;
+    network.waiting.erase(next);
+    network.connecting++;
+    network.granted++;
+    guard.unlock();
+
+    grant();
+}
+
+bool xdccd::ConnectionScheduler::cancel(const std::string &host, connect_ticket_t ticket)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto network = networks.find(host);
+    if (network == networks.end())
+        return false;
+
+    auto &waiting = network->second.waiting;
+    auto it = std::find_if(waiting.begin(), waiting.end(), [ticket](const Waiter &waiter) { return waiter.ticket == ticket; });
+
+    if (it == waiting.end())
+        return false;
+
+    waiting.erase(it);
+    return true;
+}
+
+std::chrono::milliseconds xdccd::ConnectionScheduler::next_delay(std::chrono::milliseconds previous)
+{
+    std::chrono::milliseconds::rep min = xdccd::connection::MIN_RECONNECT_DELAY.count();
+    std::chrono::milliseconds::rep max = std::chrono::duration_cast<std::chrono::milliseconds>(xdccd::connection::MAX_RECONNECT_DELAY).count();
+    std::chrono::milliseconds::rep upper = std::min(max, std::max(min, previous.count() * 3));
+
+    std::lock_guard<std::mutex> guard(lock);
+    std::uniform_int_distribution<std::chrono::milliseconds::rep> distribution(min, upper);
+    return std::chrono::milliseconds(distribution(random));
+}
+
+std::vector<xdccd::NetworkStats> xdccd::ConnectionScheduler::get_stats()
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    std::vector<NetworkStats> result;
+    for (auto &network : networks)
+        result.push_back(NetworkStats{network.first, network.second.connecting, network.second.waiting.size(), network.second.granted});
+
+    return result;
+}
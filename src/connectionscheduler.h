@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <random>
+
+namespace xdccd
+{
+
+namespace connection
+{
+// Number of connection attempts allowed to run at the same time per host
+static const std::size_t MAX_CONCURRENT_CONNECTS(2);
+}
+
+typedef std::size_t connect_ticket_t;
+typedef std::function<int (void)> priority_handler_t;
+typedef std::function<void (void)> grant_handler_t;
+
+struct NetworkStats
+{
+    std::string host;
+    std::size_t connecting;
+    std::size_t waiting;
+    std::size_t granted;
+};
+
+// Coordinates connection attempts of all bots, so they do not reconnect to
+// the same host in lockstep (and trigger the server's connection throttle)
+// after a network outage.
+class ConnectionScheduler
+{
+    public:
+        ConnectionScheduler(std::size_t max_concurrent = connection::MAX_CONCURRENT_CONNECTS);
+
+        // Queues a connection attempt to host. grant is called (from whichever
+        // thread frees up a slot) once the attempt may start, waiting attempts
+        // with a higher priority go first, priority is called from that
+        // thread as well. Every grant has to be followed by a call to
+        // release().
+        connect_ticket_t request(const std::string &host, const priority_handler_t &priority, const grant_handler_t &grant);
+        void release(const std::string &host);
+
+        // Removes a still waiting request, returns false if it was already granted
+        bool cancel(const std::string &host, connect_ticket_t ticket);
+
+        // Decorrelated jitter: random delay between MIN_RECONNECT_DELAY and
+        // three times the previous delay, capped at MAX_RECONNECT_DELAY
+        std::chrono::milliseconds next_delay(std::chrono::milliseconds previous);
+
+        std::vector<NetworkStats> get_stats();
+
+    private:
+        struct Waiter
+        {
+            connect_ticket_t ticket;
+            priority_handler_t priority;
+            grant_handler_t grant;
+        };
+
+        struct Network
+        {
+            Network();
+
+            std::size_t connecting;
+            std::size_t granted;
+            std::list<Waiter> waiting;
+        };
+
+        std::size_t max_concurrent;
+        connect_ticket_t last_ticket;
+        std::map<std::string, Network> networks;
+        std::mt19937 random;
+        std::mutex lock;
+};
+
+}
@@ -1,39 +1,71 @@
+#include <algorithm>
+#include <cctype>
 #include <cinttypes>
+#include <cstdlib>
 #include <boost/format.hpp>
+#include <boost/filesystem/operations.hpp>
 
 #include "dccbot.h"
 #include "ircmessage.h"
 
-
-xdccd::DCCAnnounce::DCCAnnounce(
-        xdccd::bot_id_t bot_id,
-        const std::string &bot_name,
-        const std::string &filename,
-        const std::string &size,
-        const std::string &slot,
-        const std::string &download_count)
-    : bot_id(bot_id), hash(bot_name+slot), bot_name(bot_name), filename(filename), size(size), slot(slot), download_count(download_count)
+namespace
 {
-    std::string tmp = size;
-    std::size_t factor = 1;
-    if (tmp[tmp.size()-1] == 'M')
-        factor = 1024;
-    else if (tmp[tmp.size()-1] == 'G')
-        factor = 1024 * 1024;
+    std::uint64_t fnv1a(const char *data, std::size_t length, std::uint64_t hash = 0xcbf29ce484222325ULL)
+    {
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 0x100000001b3ULL;
+        }
 
-    tmp[tmp.size()-1] = '\0';
-    num_size = std::stoull(tmp) * factor;
-}
+        return hash;
+    }
 
-bool xdccd::DCCAnnounce::compare(const std::string &other) const
-{
-    return boost::algorithm::icontains(filename, other);
+    // Reads the slot and download count at the start of an announce
+    // ("#12  34x [...") without the regex, and the position of the rest.
+    // Returns false for anything the regex could not match.
+    bool split_announce(const std::string &text, std::uint16_t &slot, std::uint32_t &download_count, std::size_t &rest)
+    {
+        std::size_t pos = 1;
+        if (text.empty() || text[0] != '#')
+            return false;
+
+        slot = 0;
+        for (; pos < text.size() && pos <= 3 && std::isdigit(static_cast<unsigned char>(text[pos])); ++pos)
+            slot = static_cast<std::uint16_t>(slot * 10 + (text[pos] - '0'));
+
+        std::size_t digits_end = pos;
+        if (pos == 1)
+            return false;
+
+        for (; pos < text.size() && std::isspace(static_cast<unsigned char>(text[pos])); ++pos)
+            ;
+
+        if (pos == digits_end)
+            return false;
+
+        // Saturates like the store does on overflow
+        std::uint64_t count = 0;
+        std::size_t count_begin = pos;
+        for (; pos < text.size() && std::isdigit(static_cast<unsigned char>(text[pos])); ++pos)
+            count = std::min<std::uint64_t>(count * 10 + static_cast<std::uint64_t>(text[pos] - '0'), UINT32_MAX);
+
+        if (pos == count_begin || pos == text.size() || text[pos] != 'x')
+            return false;
+
+        download_count = static_cast<std::uint32_t>(count);
+        rest = pos + 1;
+        return true;
+    }
 }
 
+
 xdccd::DCCRequest::DCCRequest(const std::string &nick, const std::string &slot, DCCAnnouncePtr announce, bool stream)
     : nick(nick),
     slot(slot),
-    announce(announce)
+    announce(announce),
+    watched(false),
+    release(0)
 {
 }
 
@@ -44,17 +76,31 @@ xdccd::DCCBot::DCCBot(bot_id_t id,
         const std::string &port,
         const std::string &nick,
         const std::vector<std::string> &channels,
-        bool use_ssl,
+        SSLContextPtr ssl_context,
+        ConnectionScheduler &scheduler,
         DownloadManager &dl_manager)
 
     : id(id),
     nickname(nick),
-    connection(host, port, ([this](const std::string &msg) { this->read_handler(msg); }),([this]() { this->on_connected(); }), use_ssl),
+    connection(host, port, ([this](const std::string &msg) { this->read_handler(msg); }),([this]() { this->on_connected(); }), ssl_context, scheduler),
     download_manager(dl_manager),
     channels_to_join(channels),
-    total_announces_size(0),
-    announce_regex(xdccd::regex::ANNOUNCE)
+    announces(id),
+    publish_timer(connection.get_io_service()),
+    publish_pending(false),
+    pending_requests(0),
+    running_downloads(std::make_shared<std::atomic<std::size_t>>(0)),
+    announce_regex(xdccd::regex::ANNOUNCE),
+    checkpoint_timer(connection.get_io_service()),
+    restoring(false),
+    pack_lists_enabled(false),
+    pack_list_timer(connection.get_io_service()),
+    received_pack_lists(std::make_shared<ReceivedPackLists>()),
+    watch_list(nullptr)
 {
+    connection.set_priority_handler([this]() { return this->get_priority(); });
+    register_handlers();
+
     std::string result = boost::algorithm::join(channels, ", ");
     BOOST_LOG_TRIVIAL(info) << "Started " << *this << " for '" << host << ":" << port << "', called '" << nick  << "', auto-joining: " << result;
 }
@@ -66,60 +112,50 @@ xdccd::DCCBot::~DCCBot()
 
 void xdccd::DCCBot::read_handler(const std::string &message)
 {
-
     xdccd::IRCMessage msg(message);
+    dispatcher.dispatch(msg);
+}
 
-    if (msg.command == "PING")
-    {
-        connection.write("PONG " + msg.params[0]);
-        return;
-    }
+void xdccd::DCCBot::register_handlers()
+{
+    dispatcher.register_handler(irc::PING, [this](const IRCMessage &msg) { connection.write("PONG " + msg.params[0]); });
 
     // 001 is the server's welcome message
-    if (msg.command == "001")
-    {
-        on_welcome();
-        return;
-    }
+    dispatcher.register_handler(irc::RPL_WELCOME, [this](const IRCMessage &) { on_welcome(); });
 
     // 366 is the end of a channel's name list
-    if (msg.command == "366")
-    {
-        on_join(msg.params[1]);
-        return;
-    }
+    dispatcher.register_handler(irc::RPL_ENDOFNAMES, [this](const IRCMessage &msg) { on_join(msg.params[1]); });
 
     // Check if we somehow left the channel
-    if (msg.command == "PART" && msg.nickname == nickname)
+    dispatcher.register_handler(irc::PART, [this](const IRCMessage &msg)
     {
-        on_part(msg.params[0]);
-        return;
-    }
+        if (msg.nickname == nickname)
+            on_part(msg.params[0]);
+    });
 
     // Check if we got kicked from the channel
-    if (msg.command == "KICK" && msg.params[1] == nickname)
+    dispatcher.register_handler(irc::KICK, [this](const IRCMessage &msg)
     {
-        on_part(msg.params[0]);
-        return;
-    }
+        if (msg.params[1] == nickname)
+            on_part(msg.params[0]);
+    });
 
     // Nickname already in use
-    if (msg.command == "433")
+    dispatcher.register_handler(irc::ERR_NICKNAMEINUSE, [this](const IRCMessage &)
     {
         // Just append a random number to the end of the nickname
         std::string new_nick = nickname + std::to_string(std::rand() % 10);
         BOOST_LOG_TRIVIAL(info) << "Nick of " << *this << " is already in use, changing it to '" << new_nick << "'!";
         change_nick(new_nick);
-        return;
-    }
+    });
 
     // Erronous nickname
-    if (msg.command == "432")
+    dispatcher.register_handler(irc::ERR_ERRONEUSNICKNAME, [](const IRCMessage &)
     {
         // TODO somehow handle this
-    }
+    });
 
-    if (msg.command == "PRIVMSG")
+    dispatcher.register_handler(irc::PRIVMSG, [this](const IRCMessage &msg)
     {
         if (msg.ctcp)
         {
@@ -130,13 +166,13 @@ void xdccd::DCCBot::read_handler(const std::string &message)
         on_privmsg(msg);
 
         if (msg.params[0] == nickname)
-            BOOST_LOG_TRIVIAL(info) << "Received private message: " << message;
-    }
+            BOOST_LOG_TRIVIAL(debug) << "Received private message: " << msg.raw;
+    });
 
-    if (msg.command == "NOTICE")
+    dispatcher.register_handler(irc::NOTICE, [](const IRCMessage &msg)
     {
-        BOOST_LOG_TRIVIAL(info) << "Received notice: " << message;
-    }
+        BOOST_LOG_TRIVIAL(debug) << "Received notice: " << msg.raw;
+    });
 }
 
 void xdccd::DCCBot::on_ctcp(const xdccd::IRCMessage &msg)
@@ -187,6 +223,9 @@ void xdccd::DCCBot::on_ctcp(const xdccd::IRCMessage &msg)
                             % size).str());
             }
 
+            if (receive_pack_list(msg.nickname, ip, port, filename, size, active))
+                return;
+
             auto request_iter = requests.find(msg.nickname);
 
             // DCC SEND offer has not been requested by us
@@ -194,8 +233,30 @@ void xdccd::DCCBot::on_ctcp(const xdccd::IRCMessage &msg)
                 return;
             else
             {
-                download_manager.start_download(ip, port, filename, std::stoull(size), active, false);//request_iter->second->stream);
+                auto running = running_downloads;
+                (*running)++;
+
+                // Watched releases only count as downloaded once they are
+                // complete, failed ones can be tried from other bots
+                WatchList *watched_list = request_iter->second->watched ? watch_list : nullptr;
+                release_t release = request_iter->second->release;
+
+                download_manager.start_download(ip, port, filename, std::stoull(size), active, false,
+                    [running, watched_list, release](AbstractTargetPtr target)
+                    {
+                        (*running)--;
+
+                        if (!watched_list)
+                            return;
+
+                        if (target->received == target->size)
+                            watched_list->complete(release);
+                        else
+                            watched_list->abandon(release);
+                    });
+
                 requests.erase(request_iter);
+                pending_requests--;
             }
         }
     }
@@ -209,6 +270,48 @@ void xdccd::DCCBot::run()
 
 void xdccd::DCCBot::stop()
 {
+    // Publish what's left of the last batch, without requesting anything
+    // for the watch list on the way out, and save it with the rest. This
+    // runs right away if we are called from within the io_service.
+    auto saved = std::make_shared<std::promise<void>>();
+    std::future<void> final_checkpoint = saved->get_future();
+
+    auto final_flush = [this, saved]()
+    {
+        publish_timer.cancel();
+        announces.flush();
+        save_announces();
+
+        // Unanswered watched requests won't be answered anymore, other bots
+        // may download their releases
+        for (auto request = requests.begin(); request != requests.end();)
+        {
+            if (request->second->watched)
+            {
+                watch_list->abandon(request->second->release);
+                request = requests.erase(request);
+                pending_requests--;
+            }
+            else
+                ++request;
+        }
+
+        saved->set_value();
+    };
+
+    // Nothing else touches the announces once the io_service has stopped
+    if (connection.get_io_service().stopped())
+        final_flush();
+    else
+        connection.get_io_service().dispatch(final_flush);
+
+    // The io_service might not be running yet
+    if (final_checkpoint.wait_for(xdccd::announcefile::FINAL_CHECKPOINT_TIMEOUT) != std::future_status::ready)
+    {
+        BOOST_LOG_TRIVIAL(warning) << "Could not publish the last announces of " << *this << " before saving them";
+        save_announces();
+    }
+
     BOOST_LOG_TRIVIAL(info) << "Disconnecting bot " << *this;
     connection.write("QUIT :Bye");
     connection.close();
@@ -245,30 +348,52 @@ void xdccd::DCCBot::on_part(const std::string &channel)
 
 void xdccd::DCCBot::on_privmsg(const xdccd::IRCMessage &msg)
 {
+    const std::string &text = msg.params[1];
+    std::uint16_t slot;
+    std::uint32_t download_count;
+    std::size_t rest;
+
+    // Most messages are chatter, and most announces are repeated unchanged
+    // but for their download count. Those only need to be seen again.
+    if (!split_announce(text, slot, download_count, rest))
+        return;
+
+    std::uint64_t key = fnv1a(msg.nickname.data(), msg.nickname.size()) ^ slot;
+    std::uint64_t fingerprint = fnv1a(text.data() + rest, text.size() - rest, key);
+
+    auto known = announce_fingerprints.find(key);
+    if (known != announce_fingerprints.end() && known->second == fingerprint && announces.touch(msg.nickname, slot, download_count, xdccd::store::now()))
+        return;
+
     std::smatch m;
-    if (!std::regex_match(msg.params[1], m, announce_regex))
+    if (!std::regex_match(text, m, announce_regex))
         return;
 
+    announce_fingerprints[key] = fingerprint;
+
     if (!m.empty() && m.size() == 5)
     {
         std::vector<std::string> result;
         for (std::size_t i = 1; i < m.size(); ++i)
             result.push_back(m[i].str());
 
-        add_announce(msg.nickname, result[3], result[2], result[0], result[1]);
+        add_announce(msg.nickname, msg.params[0], result[3], result[2], result[0], result[1]);
     }
 }
 
-void xdccd::DCCBot::request_file(const std::string &nick, const std::string &slot, bool stream)
+xdccd::DCCRequest &xdccd::DCCBot::request_file(const std::string &nick, const std::string &slot, bool stream)
 {
     BOOST_LOG_TRIVIAL(info) << "Requesting file in slot #" << slot << " from bot '" << nick << "' on " << *this << " (streaming: " << stream << ")";
 
     connection.write((boost::format("PRIVMSG %s :xdcc send #%s") % nick % slot).str());
 
     // Check if we already discovered the file the user wants to download
-    DCCAnnouncePtr announce = get_announce(nick + slot);
+    DCCAnnouncePtr announce = announces.snapshot()->find(nick, slot);
 
-    requests.insert(std::pair<std::string, DCCRequestPtr>(nick, std::make_unique<DCCRequest>(nick, slot, announce, stream)));
+    auto request = requests.insert(std::pair<std::string, DCCRequestPtr>(nick, std::make_unique<DCCRequest>(nick, slot, announce, stream)));
+    pending_requests++;
+
+    return *request->second;
 }
 
 const std::vector<std::string> &xdccd::DCCBot::get_channels() const
@@ -291,43 +416,355 @@ const std::string &xdccd::DCCBot::get_port() const
     return connection.get_port();
 }
 
-void xdccd::DCCBot::add_announce(const std::string &bot, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count)
+void xdccd::DCCBot::add_announce(const std::string &bot, const std::string &channel, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count)
 {
-    DCCAnnouncePtr announce = std::make_shared<DCCAnnounce>(id, bot, filename, size, slot, download_count);
-    total_announces_size += announce->num_size;
+    announces.add(bot, channel, filename, size, slot, download_count);
+
+    if (announces.get_unpublished_count() >= xdccd::store::PUBLISH_BATCH)
+        flush_announces();
+    else if (announces.get_unpublished_count() && !publish_pending)
+        start_publish_timer();
 
-    auto old_announce = announces.find(announce->hash);
-    if (old_announce != announces.end())
+    // Announcing bots are asked for their pack list right away
+    if (pack_lists_enabled && pack_list_sources.find(bot) == pack_list_sources.end())
+        pack_list_sources[bot] = PackListSource{channel, std::chrono::steady_clock::time_point(), std::chrono::steady_clock::now()};
+}
+
+void xdccd::DCCBot::flush_announces()
+{
+    // Announces seen before have been checked already
+    announce_id_t end = announces.snapshot()->get_end_id();
+
+    if (announces.flush())
+        watch_announces(end);
+}
+
+void xdccd::DCCBot::start_publish_timer()
+{
+    publish_pending = true;
+    publish_timer.expires_from_now(xdccd::store::PUBLISH_INTERVAL);
+    publish_timer.async_wait([this](const boost::system::error_code &error)
+    {
+        if (error)
+            return;
+
+        publish_pending = false;
+        flush_announces();
+    });
+}
+
+void xdccd::DCCBot::restore_announces(AnnounceFilePtr file, timestamp_t oldest, std::size_t next, std::size_t restored)
+{
+    std::size_t end = std::min(file->size(), next + xdccd::announcefile::RESTORE_BATCH);
+    std::vector<AnnounceRow> rows;
+    rows.reserve(end - next);
+
+    for (std::size_t i = next; i < end; ++i)
     {
-        total_announces_size -= old_announce->second->num_size;
-        announces.insert(old_announce, std::pair<std::string, DCCAnnouncePtr>(announce->hash, announce));
+        AnnounceRow row;
+        if (file->get(i, row) && row.last_seen >= oldest)
+            rows.push_back(row);
     }
-    else
-        announces[announce->hash] = announce;
+
+    // Restoring publishes the batch as well, it has to be watched first
+    flush_announces();
+    restored += announces.restore(rows);
+
+    // Let the bot handle its connection in between, the rest stays on disk until then
+    if (end < file->size())
+    {
+        connection.get_io_service().post([this, file, oldest, end, restored]() { restore_announces(file, oldest, end, restored); });
+        return;
+    }
+
+    BOOST_LOG_TRIVIAL(info) << "Restored " << restored << " of " << file->size() << " announces of " << *this << " from '" << announces_path.string() << "'";
+    restoring = false;
 }
 
-xdccd::DCCAnnouncePtr xdccd::DCCBot::get_announce(const std::string &hash) const
+void xdccd::DCCBot::start_checkpoint_timer()
 {
-    auto it = announces.find(hash);
+    checkpoint_timer.expires_from_now(xdccd::announcefile::CHECKPOINT_INTERVAL);
+    checkpoint_timer.async_wait([this](const boost::system::error_code &error)
+    {
+        if (error)
+            return;
 
-    if (it == announces.end())
-        return nullptr;
+        // Writing all announces takes a while, don't hold up the connection meanwhile
+        if (!pending_checkpoint.valid() || pending_checkpoint.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            pending_checkpoint = std::async(std::launch::async, [this]() { save_announces(); });
 
-    return it->second;
+        start_checkpoint_timer();
+    });
 }
 
-void xdccd::DCCBot::find_announces(const std::string &query, std::vector<DCCAnnouncePtr> &result) const
+void xdccd::DCCBot::save_announces()
+{
+    std::lock_guard<std::mutex> lock(checkpoint_lock);
+
+    // Saving only part of the announces would lose the rest
+    if (announces_path.empty() || restoring)
+        return;
+
+    AnnounceSnapshotPtr snapshot = announces.snapshot();
+    if (AnnounceFile::write(*snapshot, announces_path))
+        BOOST_LOG_TRIVIAL(debug) << "Saved " << snapshot->size() << " announces of " << *this << " to '" << announces_path.string() << "'";
+}
+
+void xdccd::DCCBot::sweep_announces(timestamp_t expire_before, timestamp_t cold_before, std::size_t evict)
+{
+    // Announces are only changed from within the io_service
+    connection.get_io_service().post([this, expire_before, cold_before, evict]()
+    {
+        // Announces still on disk would not be swept
+        if (restoring)
+            return;
+
+        // Sweeping publishes the last batch as well, it has to be watched first
+        flush_announces();
+
+        std::size_t expired = announces.expire(expire_before);
+        std::size_t evicted = announces.evict(evict);
+
+        if (expired || evicted)
+        {
+            BOOST_LOG_TRIVIAL(info) << "Expired " << expired << " and evicted " << evicted << " announces of " << *this;
+
+            // Fingerprints of removed announces would only take up memory
+            announce_fingerprints.clear();
+        }
+
+        // Evicting only saves memory once the rows are gone
+        if (announces.vacuum(evicted > 0, cold_before))
+            BOOST_LOG_TRIVIAL(debug) << "Vacuumed announces of " << *this << ", " << announces.snapshot()->get_memory_usage() << " bytes left";
+    });
+}
+
+void xdccd::DCCBot::request_pack_lists()
+{
+    connection.get_io_service().post([this]()
+    {
+        if (pack_lists_enabled)
+            return;
+
+        pack_lists_enabled = true;
+
+        // Bots only announcing what we know already are discovered as well
+        announce_fingerprints.clear();
+        start_pack_list_timer();
+    });
+}
+
+void xdccd::DCCBot::start_pack_list_timer()
 {
-    for (auto announce : announces)
+    pack_list_timer.expires_from_now(xdccd::packlist::REQUEST_INTERVAL);
+    pack_list_timer.async_wait([this](const boost::system::error_code &error)
+    {
+        if (error)
+            return;
+
+        add_pack_lists();
+
+        // Bots can only be asked while we're in their channels
+        if (!channels.empty())
+            request_next_pack_list();
+
+        start_pack_list_timer();
+    });
+}
+
+void xdccd::DCCBot::request_next_pack_list()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    // The bot waiting the longest goes first
+    auto next = pack_list_sources.end();
+    for (auto it = pack_list_sources.begin(); it != pack_list_sources.end(); ++it)
+    {
+        if (it->second.next_request <= now && (next == pack_list_sources.end() || it->second.next_request < next->second.next_request))
+            next = it;
+    }
+
+    if (next == pack_list_sources.end())
+        return;
+
+    BOOST_LOG_TRIVIAL(debug) << "Requesting the pack list of '" << next->first << "' on " << *this;
+    connection.write((boost::format("PRIVMSG %s :xdcc list") % next->first).str());
+
+    // Bots not answering are asked again on their next refresh
+    next->second.requested = now;
+    next->second.next_request = now + xdccd::packlist::REFRESH_INTERVAL;
+}
+
+bool xdccd::DCCBot::receive_pack_list(const std::string &nick, const std::string &ip, const std::string &port, const std::string &filename, const std::string &size, bool active)
+{
+    auto source = pack_list_sources.find(nick);
+
+    // Files we asked for take precedence
+    if (source == pack_list_sources.end() || requests.find(nick) != requests.end()
+            || std::chrono::steady_clock::now() - source->second.requested > xdccd::packlist::REQUEST_TIMEOUT)
+        return false;
+
+    source->second.requested = std::chrono::steady_clock::time_point();
+
+    file_size_t list_size = static_cast<file_size_t>(std::strtoull(size.c_str(), nullptr, 10));
+    if (list_size <= 0 || static_cast<std::size_t>(list_size) > xdccd::packlist::MAX_SIZE)
+    {
+        BOOST_LOG_TRIVIAL(warning) << "Declining pack list '" << filename << "' of '" << nick << "' on " << *this << ", its size is " << size;
+        return true;
+    }
+
+    auto received = received_pack_lists;
+    std::string bot = nick;
+
+    download_manager.start_download(ip, port, filename, list_size, active, true, [received, bot](AbstractTargetPtr target)
+    {
+        // Incomplete lists might end in a broken line, longer ones were cut off
+        if (target->received != target->size)
+        {
+            BOOST_LOG_TRIVIAL(warning) << "Receiving the pack list of '" << bot << "' failed after " << target->received << " of " << target->size << " bytes";
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(received->lock);
+        received->lists.emplace_back(bot, std::static_pointer_cast<BufferTarget>(target));
+    });
+
+    return true;
+}
+
+void xdccd::DCCBot::add_pack_lists()
+{
+    std::vector<std::pair<std::string, BufferTargetPtr>> lists;
+
+    {
+        std::lock_guard<std::mutex> lock(received_pack_lists->lock);
+        lists.swap(received_pack_lists->lists);
+    }
+
+    timestamp_t now = xdccd::store::now();
+    std::vector<AnnounceRow> rows;
+
+    // Anything announced has to be watched before the lists publish it
+    flush_announces();
+
+    for (auto &list : lists)
+    {
+        auto source = pack_list_sources.find(list.first);
+        if (source == pack_list_sources.end())
+            continue;
+
+        rows.clear();
+        std::size_t packs = parse_pack_list(list.second->get_data(), announce_regex, list.first, source->second.channel, now, rows);
+
+        // All packs of a list are published at once
+        announce_id_t end = announces.get_end_id();
+        std::size_t added = announces.add(rows);
+        watch_announces(end);
+
+        // Announces replaced by the list are no repeats anymore
+        if (added)
+            announce_fingerprints.clear();
+
+        BOOST_LOG_TRIVIAL(info) << "Received " << packs << " packs from the pack list of '" << list.first << "' on " << *this << ", " << added << " of them new or changed";
+    }
+}
+
+void xdccd::DCCBot::set_watch_list(WatchList &watch_list)
+{
+    this->watch_list = &watch_list;
+}
+
+void xdccd::DCCBot::watch_announces(announce_id_t begin)
+{
+    if (!watch_list)
+        return;
+
+    WatchAutomatonPtr automaton = watch_list->get_automaton();
+    if (automaton->empty())
+        return;
+
+    AnnounceSnapshotPtr snapshot = announces.snapshot();
+    std::vector<std::size_t> rules;
+    std::string folded_buffer, buffer;
+
+    for (announce_id_t id = begin; id < snapshot->get_end_id(); ++id)
     {
-        if (announce.second->compare(query))
-            result.push_back(announce.second);
+        if (!snapshot->is_visible(id))
+            continue;
+
+        rules.clear();
+        automaton->match(snapshot->get_folded_filename(id, folded_buffer), rules);
+
+        AnnounceRow row = snapshot->get_row(id, buffer);
+        for (std::size_t rule : rules)
+        {
+            if (!automaton->get_rule(rule).accepts(row))
+                continue;
+
+            // Other bots might offer the same release, or have offered it before
+            release_t release = snapshot->get_release(id);
+            if (watch_list->claim(release))
+            {
+                BOOST_LOG_TRIVIAL(info) << "'" << row.filename.str() << "' matches watch rule #" << automaton->get_rule(rule).id << " ('" << automaton->get_rule(rule).pattern << "')";
+
+                DCCRequest &request = request_file(row.bot_name.str(), std::to_string(row.slot), false);
+                request.watched = true;
+                request.release = release;
+                start_watch_timeout(request.nick, release);
+            }
+
+            break;
+        }
     }
 }
 
-const std::map<std::string, xdccd::DCCAnnouncePtr> &xdccd::DCCBot::get_announces() const
+void xdccd::DCCBot::start_watch_timeout(const std::string &nick, release_t release)
+{
+    auto timer = std::make_shared<boost::asio::steady_timer>(connection.get_io_service(), xdccd::watch::REQUEST_TIMEOUT);
+    timer->async_wait([this, timer, nick, release](const boost::system::error_code &error)
+    {
+        // Requests that have been answered are gone already
+        auto range = requests.equal_range(nick);
+        auto request = std::find_if(range.first, range.second, [release](const std::pair<const std::string, DCCRequestPtr> &entry) { return entry.second->watched && entry.second->release == release; });
+
+        if (request == range.second)
+            return;
+
+        // A timer that failed would leave the release claimed for good
+        if (error)
+            BOOST_LOG_TRIVIAL(warning) << "Timeout of our request for slot #" << request->second->slot << " from bot '" << nick << "' on " << *this << " failed (" << error.message() << "), giving up";
+        else
+            BOOST_LOG_TRIVIAL(warning) << "Bot '" << nick << "' did not answer our request for slot #" << request->second->slot << " on " << *this << ", giving up";
+
+        requests.erase(request);
+        pending_requests--;
+        watch_list->abandon(release);
+    });
+}
+
+void xdccd::DCCBot::find_announces(const std::string &query, std::vector<DCCAnnouncePtr> &result) const
+{
+    AnnounceSnapshotPtr snapshot = announces.snapshot();
+    std::vector<announce_id_t> ids;
+    snapshot->find(query, ids);
+
+    for (announce_id_t announce_id : ids)
+        result.push_back(snapshot->get(announce_id));
+}
+
+xdccd::AnnounceSnapshotPtr xdccd::DCCBot::get_announces() const
+{
+    return announces.snapshot();
+}
+
+xdccd::CommandDispatcher &xdccd::DCCBot::get_dispatcher()
 {
-    return announces;
+    return dispatcher;
+}
+
+const xdccd::CommandDispatcher &xdccd::DCCBot::get_dispatcher() const
+{
+    return dispatcher;
 }
 
 const std::multimap<std::string, xdccd::DCCRequestPtr> &xdccd::DCCBot::get_requests() const
@@ -346,6 +783,55 @@ void xdccd::DCCBot::change_nick(const std::string &nick)
     nickname = nick;
 }
 
+bool xdccd::DCCBot::record_traffic(const boost::filesystem::path &path)
+{
+    TrafficRecorderPtr recorder = std::make_shared<TrafficRecorder>(path);
+
+    if (!recorder->is_open())
+        return false;
+
+    BOOST_LOG_TRIVIAL(info) << "Recording traffic of " << *this << " to '" << path.string() << "'";
+    connection.set_recorder(recorder);
+    return true;
+}
+
+void xdccd::DCCBot::stop_recording()
+{
+    connection.set_recorder(nullptr);
+}
+
+void xdccd::DCCBot::set_socket_factory(const socket_factory_t &factory)
+{
+    connection.set_socket_factory(factory);
+}
+
+void xdccd::DCCBot::persist_announces(const boost::filesystem::path &path, std::chrono::seconds max_age)
+{
+    announces_path = path;
+
+    // Like expiring them, ages are unbounded without a maximum
+    timestamp_t now = xdccd::store::now();
+    timestamp_t oldest = 0;
+    if (max_age.count() > 0 && now > max_age.count())
+        oldest = static_cast<timestamp_t>(now - max_age.count());
+
+    AnnounceFilePtr file;
+    if (boost::filesystem::exists(path))
+    {
+        file = std::make_shared<AnnounceFile>(path);
+        restoring = file->is_open();
+    }
+
+    // Announces are only added from within the io_service
+    connection.get_io_service().post([this, file, oldest]()
+    {
+        if (restoring)
+            restore_announces(file, oldest, 0, 0);
+
+        start_checkpoint_timer();
+    });
+}
+
 std::string xdccd::DCCBot::to_string() const
 {
     return "<Bot #" + std::to_string(id) + " '" + nickname + "'>";
@@ -356,7 +842,17 @@ xdccd::connection::STATE xdccd::DCCBot::get_connection_state() const
     return connection.get_state();
 }
 
+int xdccd::DCCBot::get_priority() const
+{
+    // Bots with running downloads or pending requests should reconnect first.
+    // Called from other bots' threads, so only atomics are read.
+    if (*running_downloads > 0)
+        return 2;
+
+    return pending_requests > 0 ? 1 : 0;
+}
+
 xdccd::file_size_t xdccd::DCCBot::get_total_announces_size() const
 {
-    return total_announces_size;
+    return announces.snapshot()->get_total_size();
 }
@@ -1,14 +1,23 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
+#include <future>
 #include <map>
 #include <regex>
+#include <unordered_map>
 
 #include "ircconnection.h"
 #include "threadmanager.h"
 #include "logable.h"
 #include "logging.h"
 #include "downloadmanager.h"
+#include "commanddispatcher.h"
+#include "announcestore.h"
+#include "announcefile.h"
+#include "buffertarget.h"
+#include "packlist.h"
+#include "watchlist.h"
 
 namespace xdccd
 {
@@ -17,27 +26,6 @@ namespace regex
 {
     const static std::regex ANNOUNCE("#(\\d{1,3})\\s+(\\d+)x\\s+\\[\\s?(\\d+(?:\\.\\d+)?[KMG])\\] (.*)", std::regex_constants::ECMAScript);
 }
-class IRCMessage;
-
-typedef std::size_t bot_id_t;
-
-struct DCCAnnounce
-{
-    DCCAnnounce(bot_id_t bot_id, const std::string &bot_name, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count);
-
-    bot_id_t bot_id;
-    std::string hash;
-    std::string bot_name;
-    std::string filename;
-    std::string size;
-    std::string slot;
-    std::string download_count;
-    std::size_t num_size;
-
-    bool compare(const std::string &other) const;
-};
-
-typedef std::shared_ptr<DCCAnnounce> DCCAnnouncePtr;
 
 class DCCRequest
 {
@@ -48,14 +36,34 @@ class DCCRequest
         std::string slot;
         DCCAnnouncePtr announce;
         bool stream;
+
+        // Requested for the watch list, which has release claimed
+        bool watched;
+        release_t release;
 };
 
 typedef std::unique_ptr<DCCRequest> DCCRequestPtr;
 
+// An announcing bot whose pack list we ask for
+struct PackListSource
+{
+    // Channel the bot announces in, its packs are added as if announced there
+    std::string channel;
+    std::chrono::steady_clock::time_point requested;
+    std::chrono::steady_clock::time_point next_request;
+};
+
+// Pack lists received, but not added to the announces yet
+struct ReceivedPackLists
+{
+    std::mutex lock;
+    std::vector<std::pair<std::string, BufferTargetPtr>> lists;
+};
+
 class DCCBot : public Logable<DCCBot>
 {
     public:
-        DCCBot(bot_id_t id, const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, bool use_ssl, DownloadManager &download_manager);
+        DCCBot(bot_id_t id, const std::string &host, const std::string &port, const std::string &nick, const std::vector<std::string> &channels, SSLContextPtr ssl_context, ConnectionScheduler &scheduler, DownloadManager &download_manager);
         virtual ~DCCBot();
         void read_handler(const std::string &message);
 
@@ -69,7 +77,8 @@ class DCCBot : public Logable<DCCBot>
         void on_part(const std::string &channel);
         void on_privmsg(const xdccd::IRCMessage &msg);
 
-        void request_file(const std::string &nick, const std::string &slot, bool stream);
+        // Returns the request, which is valid until it is answered
+        DCCRequest &request_file(const std::string &nick, const std::string &slot, bool stream);
 
         bot_id_t get_id() const;
         const std::vector<std::string> &get_channels() const;
@@ -78,34 +87,125 @@ class DCCBot : public Logable<DCCBot>
         const std::string &get_port() const;
         connection::STATE get_connection_state() const;
         file_size_t get_total_announces_size() const;
+        int get_priority() const;
         virtual std::string to_string() const;
 
-        const std::map<std::string, DCCAnnouncePtr> &get_announces() const;
+        // Latest snapshot of our announces, safe to call from any thread
+        AnnounceSnapshotPtr get_announces() const;
+
+        // Announces are published in batches, this publishes the ones
+        // received since the last batch right away. Only to be called from
+        // within the io_service, like read_handler().
+        void flush_announces();
         const std::multimap<std::string, DCCRequestPtr> &get_requests() const;
+
+        // Handlers registered here have to be added before the bot is run
+        CommandDispatcher &get_dispatcher();
+        const CommandDispatcher &get_dispatcher() const;
         void find_announces(const std::string &query, std::vector<DCCAnnouncePtr> &result) const;
 
         void change_nick(const std::string &nick);
 
+        bool record_traffic(const boost::filesystem::path &path);
+        void stop_recording();
+        void set_socket_factory(const socket_factory_t &factory);
+
+        // Restores the announces saved to path by an earlier run, in the
+        // background, and checkpoints them to it from now on. Announces not
+        // seen for max_age are not restored, zero restores all of them.
+        void persist_announces(const boost::filesystem::path &path, std::chrono::seconds max_age = std::chrono::duration_cast<std::chrono::seconds>(announcefile::MAX_AGE));
+
+        // Deletes announces last seen before expire_before, then the evict
+        // ones seen least recently to save memory, and compresses the
+        // filenames of the ones last seen before cold_before. Runs in the
+        // background, safe to call from any thread.
+        void sweep_announces(timestamp_t expire_before, timestamp_t cold_before, std::size_t evict);
+
+        // Asks every bot announcing in our channels for its full pack list
+        // from now on, and refreshes them regularly. Lists are received in
+        // memory and added to the announces at once. Safe to call from any
+        // thread.
+        void request_pack_lists();
+
+        // Requests every release announced from now on that matches a rule
+        // of watch_list, unless it has been downloaded before. watch_list
+        // has to outlive us, and be set before the bot is run.
+        void set_watch_list(WatchList &watch_list);
+
         static xdccd::logger_type_t logger;
 
     private:
-        void add_announce(const std::string &bot, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count);
-        DCCAnnouncePtr get_announce(const std::string &hash) const;
+        void register_handlers();
+        void add_announce(const std::string &bot, const std::string &channel, const std::string &filename, const std::string &size, const std::string &slot, const std::string &download_count);
+
+        void start_publish_timer();
+
+        void restore_announces(AnnounceFilePtr file, timestamp_t oldest, std::size_t next, std::size_t restored);
+        void start_checkpoint_timer();
+        void save_announces();
+
+        void start_pack_list_timer();
+        void request_next_pack_list();
+
+        // Starts receiving the file nick offers if it's the pack list we
+        // asked for, returns false otherwise
+        bool receive_pack_list(const std::string &nick, const std::string &ip, const std::string &port, const std::string &filename, const std::string &size, bool active);
+        void add_pack_lists();
+
+        // Checks the announces added since begin against the watch list
+        void watch_announces(announce_id_t begin);
+
+        // Gives up the watched request of release from nick if it hasn't
+        // been answered after watch::REQUEST_TIMEOUT, or the timer failed
+        void start_watch_timeout(const std::string &nick, release_t release);
 
         bot_id_t id;
         std::string nickname;
 
         IRCConnection connection;
+        CommandDispatcher dispatcher;
         DownloadManager &download_manager;
 
         std::vector<std::string> channels;
         std::vector<std::string> channels_to_join;
-        std::map<std::string, DCCAnnouncePtr> announces;
-        file_size_t total_announces_size;
+        AnnounceStore announces;
+
+        // Fingerprint of the last announce line of each (bot, slot), so
+        // repeated announces skip the regex. Only accessed from within the
+        // io_service.
+        std::unordered_map<std::uint64_t, std::uint64_t> announce_fingerprints;
+
+        boost::asio::steady_timer publish_timer;
+        bool publish_pending;
 
         std::multimap<std::string, DCCRequestPtr> requests;
 
+        // Size of requests, read by the connection scheduler from other
+        // bots' threads, which must not touch requests itself
+        std::atomic<std::size_t> pending_requests;
+
+        // Shared with the finished handlers of our downloads, which might outlive us
+        std::shared_ptr<std::atomic<std::size_t>> running_downloads;
+
         std::regex announce_regex;
+
+        boost::filesystem::path announces_path;
+        boost::asio::steady_timer checkpoint_timer;
+        std::atomic<bool> restoring;
+        std::mutex checkpoint_lock;
+
+        // Only accessed from within the io_service
+        bool pack_lists_enabled;
+        std::map<std::string, PackListSource> pack_list_sources;
+        boost::asio::steady_timer pack_list_timer;
+
+        // Shared with the finished handlers of the lists' downloads
+        std::shared_ptr<ReceivedPackLists> received_pack_lists;
+
+        WatchList *watch_list;
+
+        // Last member, so a running checkpoint is waited for before anything it uses is gone
+        std::future<void> pending_checkpoint;
 };
 
 typedef std::shared_ptr<DCCBot> DCCBotPtr;
@@ -177,7 +177,7 @@ boost::system::error_code xdccd::DCCReceiveTask::download(boost::asio::ip::tcp::
             old_percent = percent;
         }
 
-        if (error == boost::asio::error::eof || target->received == target->size)
+        if (error == boost::asio::error::eof || target->received >= target->size)
             break; // Connection closed cleanly by peer.
         else if (error)
             break;
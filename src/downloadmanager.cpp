@@ -9,12 +9,13 @@ xdccd::DownloadManager::DownloadManager(ThreadManager &thread_man, const boost::
 {
 }
 
-void xdccd::DownloadManager::start_download(const std::string &host,
+xdccd::file_id_t xdccd::DownloadManager::start_download(const std::string &host,
         const std::string &port,
         const std::string &filename,
         xdccd::file_size_t size,
         bool active,
-        bool stream)
+        bool stream,
+        const download_finished_handler_t &finished_handler)
 {
     AbstractTargetPtr target;
 
@@ -28,14 +29,34 @@ void xdccd::DownloadManager::start_download(const std::string &host,
     std::lock_guard<std::mutex> lock(transfers_lock);
     transfers[target->id] = task;
 
+    if (finished_handler)
+        finished_handlers[target->id] = finished_handler;
+
     thread_manager.run_task(task);
+
+    return target->id;
 }
 
 void xdccd::DownloadManager::on_file_finished(file_id_t file_id)
 {
-    std::lock_guard<std::mutex> lock(transfers_lock);
-    DCCReceiveTaskPtr task = transfers[file_id];
-    AbstractTargetPtr target = task->get_target();
+    download_finished_handler_t handler;
+    AbstractTargetPtr target;
+
+    {
+        std::lock_guard<std::mutex> lock(transfers_lock);
+        DCCReceiveTaskPtr task = transfers[file_id];
+        target = task->get_target();
+
+        auto handler_it = finished_handlers.find(file_id);
+        if (handler_it != finished_handlers.end())
+        {
+            handler = handler_it->second;
+            finished_handlers.erase(handler_it);
+        }
+    }
+
+    if (handler)
+        handler(target);
 }
 
 std::vector<xdccd::AbstractTargetPtr> xdccd::DownloadManager::get_finished_files()
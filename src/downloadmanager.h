@@ -10,11 +10,13 @@
 namespace xdccd
 {
 
+typedef std::function<void (AbstractTargetPtr)> download_finished_handler_t;
+
 class DownloadManager
 {
     public:
         DownloadManager(ThreadManager &thread_man, const boost::filesystem::path &download_path);
-        void start_download(const std::string &host, const std::string &port, const std::string &filename, file_size_t size, bool active, bool stream);
+        file_id_t start_download(const std::string &host, const std::string &port, const std::string &filename, file_size_t size, bool active, bool stream, const download_finished_handler_t &finished_handler = nullptr);
 
         std::vector<AbstractTargetPtr> get_finished_files();
         std::map<file_id_t, DCCReceiveTaskPtr> get_transfers();
@@ -31,6 +33,7 @@ class DownloadManager
         std::mutex finished_files_lock;
 
         std::map<file_id_t, DCCReceiveTaskPtr> transfers;
+        std::map<file_id_t, download_finished_handler_t> finished_handlers;
         std::mutex transfers_lock;
 };
 
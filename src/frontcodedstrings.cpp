@@ -0,0 +1,124 @@
+#include <algorithm>
+
+#include "frontcodedstrings.h"
+
+namespace
+{
+    void append_varint(std::vector<std::uint8_t> &data, std::size_t value)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back(static_cast<std::uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        data.push_back(static_cast<std::uint8_t>(value));
+    }
+
+    std::size_t read_varint(const std::uint8_t *&pos)
+    {
+        std::size_t value = 0;
+        unsigned int shift = 0;
+
+        while (*pos & 0x80)
+        {
+            value |= static_cast<std::size_t>(*pos++ & 0x7f) << shift;
+            shift += 7;
+        }
+
+        return value | static_cast<std::size_t>(*pos++) << shift;
+    }
+
+    // Replaces all but the shared prefix of str with the next entry
+    void decode_next(const std::uint8_t *&pos, std::string &str)
+    {
+        std::size_t shared = read_varint(pos);
+        std::size_t length = read_varint(pos);
+
+        str.resize(shared);
+        str.append(reinterpret_cast<const char*>(pos), length);
+        pos += length;
+    }
+}
+
+xdccd::FrontCodedStrings::Iterator::Iterator(const FrontCodedStrings &strings)
+    : pos(strings.data.data()), end(strings.data.data() + strings.data.size()), current_index(SIZE_MAX)
+{
+    next();
+}
+
+bool xdccd::FrontCodedStrings::Iterator::valid() const
+{
+    return current_index != SIZE_MAX;
+}
+
+std::size_t xdccd::FrontCodedStrings::Iterator::index() const
+{
+    return current_index;
+}
+
+const std::string &xdccd::FrontCodedStrings::Iterator::value() const
+{
+    return current;
+}
+
+void xdccd::FrontCodedStrings::Iterator::next()
+{
+    if (pos == end)
+    {
+        current_index = SIZE_MAX;
+        return;
+    }
+
+    // The first string wraps around to index 0
+    decode_next(pos, current);
+    current_index++;
+}
+
+xdccd::FrontCodedStrings::FrontCodedStrings()
+    : count(0)
+{
+}
+
+std::size_t xdccd::FrontCodedStrings::add(StringRef str)
+{
+    std::size_t shared = 0;
+
+    if (count % xdccd::frontcoding::BLOCK_SIZE == 0)
+        blocks.push_back(data.size());
+    else
+        shared = std::mismatch(last.begin(), last.begin() + std::min(last.size(), str.length), str.data).first - last.begin();
+
+    append_varint(data, shared);
+    append_varint(data, str.length - shared);
+    data.insert(data.end(), str.data + shared, str.data + str.length);
+
+    last.assign(str.data, str.length);
+    return count++;
+}
+
+void xdccd::FrontCodedStrings::get(std::size_t index, std::string &result) const
+{
+    const std::uint8_t *pos = data.data() + blocks[index / xdccd::frontcoding::BLOCK_SIZE];
+
+    result.clear();
+    for (std::size_t i = index - index % xdccd::frontcoding::BLOCK_SIZE; i <= index; ++i)
+        decode_next(pos, result);
+}
+
+std::size_t xdccd::FrontCodedStrings::size() const
+{
+    return count;
+}
+
+void xdccd::FrontCodedStrings::shrink_to_fit()
+{
+    data.shrink_to_fit();
+    blocks.shrink_to_fit();
+    std::string().swap(last);
+}
+
+std::size_t xdccd::FrontCodedStrings::get_memory_usage() const
+{
+    return data.capacity() + blocks.capacity() * sizeof(std::size_t) + last.capacity();
+}
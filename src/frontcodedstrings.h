@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "stringarena.h"
+
+namespace xdccd
+{
+
+namespace frontcoding
+{
+// Number of strings per block, each block starts with a complete string
+static const std::size_t BLOCK_SIZE(16);
+}
+
+// Append-only list of strings, each stored as the length of the prefix it
+// shares with the one before it and the rest. Strings added in sorted order
+// share long prefixes, so this takes a fraction of their size. Getting a
+// string decodes its block up to it. Not to be added to once shared.
+class FrontCodedStrings
+{
+    public:
+        // Decodes all strings in order, cheaper than getting them one by one
+        class Iterator
+        {
+            public:
+                Iterator(const FrontCodedStrings &strings);
+
+                bool valid() const;
+                std::size_t index() const;
+                const std::string &value() const;
+                void next();
+
+            private:
+                const std::uint8_t *pos;
+                const std::uint8_t *end;
+                std::size_t current_index;
+                std::string current;
+        };
+
+        FrontCodedStrings();
+
+        // Returns the index of str
+        std::size_t add(StringRef str);
+
+        void get(std::size_t index, std::string &result) const;
+        std::size_t size() const;
+
+        // Frees what is only needed to add strings
+        void shrink_to_fit();
+        std::size_t get_memory_usage() const;
+
+    private:
+        std::vector<std::uint8_t> data;
+
+        // Offset of the first string of every block in data
+        std::vector<std::size_t> blocks;
+        std::size_t count;
+
+        // Last string added
+        std::string last;
+};
+
+}
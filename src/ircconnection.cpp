@@ -5,36 +5,54 @@
 
 #include "ircconnection.h"
 
-xdccd::IRCConnection::IRCConnection(const std::string &host, std::string port, const read_handler_t &read_handler, const connected_handler_t &connected_handler, bool use_ssl)
+xdccd::IRCConnection::IRCConnection(const std::string &host, std::string port, const read_handler_t &read_handler, const connected_handler_t &connected_handler, SSLContextPtr ssl_context, ConnectionScheduler &scheduler)
     : host(host),
     port(port),
-    use_ssl(use_ssl),
+    ssl_context(ssl_context),
     state(connection::IDLE),
     resolver(io_service),
     work(std::make_unique<boost::asio::io_service::work>(io_service)),
     read_handler(read_handler),
     connected_handler(connected_handler),
+    scheduler(scheduler),
+    connect_ticket(0),
+    connect_pending(false),
     bytes_read(0),
     bytes_written(0),
     reconnect_delay(xdccd::connection::MIN_RECONNECT_DELAY),
-    timeout_timer(io_service),
     reconnect_timer(io_service),
-    message_received(false),
-    timeout_triggered(false)
+    keepalive_timer(io_service),
+    ping_pending(false)
 {
 }
 
+void xdccd::IRCConnection::schedule_connect()
+{
+    state = connection::CONNECTING;
+    connect_pending = true;
+
+    // The scheduler calls us back as soon as we may connect to the host
+    connect_ticket = scheduler.request(host, priority_handler, [this]() { io_service.post([this]() { connect(); }); });
+}
+
+void xdccd::IRCConnection::finish_connect()
+{
+    // Free our slot, so the next bot waiting for this host can connect
+    if (connect_pending.exchange(false))
+        scheduler.release(host);
+}
+
 void xdccd::IRCConnection::connect()
 {
-    if (use_ssl)
-        socket = std::make_unique<xdccd::SSLSocket>(io_service);
+    if (socket_factory)
+        socket = socket_factory(io_service);
+    else if (ssl_context)
+        socket = std::make_unique<xdccd::SSLSocket>(io_service, ssl_context);
     else
         socket = std::make_unique<xdccd::PlainSocket>(io_service);
 
     boost::asio::ip::tcp::resolver::query query(host, port);
 
-    state = connection::CONNECTING;
-
     BOOST_LOG_TRIVIAL(debug) << "Trying to resolve " << host << "...";
     resolver.async_resolve(query,
         boost::bind(&xdccd::IRCConnection::on_resolved, this,
@@ -50,6 +68,7 @@ void xdccd::IRCConnection::on_resolved(const boost::system::error_code& err, boo
     if (err)
     {
         BOOST_LOG_TRIVIAL(error) << "Error resolving " << host << ": " << err.message();
+        finish_connect();
         start_reconnect_timer();
         return;
     }
@@ -67,15 +86,22 @@ void xdccd::IRCConnection::on_resolved(const boost::system::error_code& err, boo
     if (error)
     {
         BOOST_LOG_TRIVIAL(error) << "Error connecting to " << host << ": " << error.message();
+        finish_connect();
         start_reconnect_timer();
         return;
     }
 
+    finish_connect();
+
     // Inform the bot about the successful connection
     connected_handler();
 
     state = connection::CONNECTED;
 
+    last_activity = std::chrono::steady_clock::now();
+    ping_pending = false;
+    start_keepalive_timer();
+
     // Start the async read loop
     socket->async_read_until(
             msg_buffer,
@@ -88,44 +114,51 @@ void xdccd::IRCConnection::on_resolved(const boost::system::error_code& err, boo
 
 void xdccd::IRCConnection::run()
 {
-    connect();
+    schedule_connect();
+    io_service.run();
+}
 
-    while (!io_service.stopped() && io_service.run_one())
-    {
-        std::lock_guard<std::mutex> lock(io_lock);
+void xdccd::IRCConnection::start_keepalive_timer()
+{
+    keepalive_timer.expires_from_now(xdccd::connection::KEEPALIVE_INTERVAL);
+    keepalive_timer.async_wait(boost::bind(&IRCConnection::on_keepalive, this, boost::asio::placeholders::error));
+}
 
-        if (message_received)
-        {
-            timeout_timer.cancel();
+void xdccd::IRCConnection::on_keepalive(const boost::system::error_code &error)
+{
+    if (error || state != connection::CONNECTED)
+        return;
 
-            timeout_lock.lock();
-            message_received = false;
+    auto now = std::chrono::steady_clock::now();
 
-            // Restart timeout timer
-            timeout_timer.expires_from_now(xdccd::connection::READ_TIMEOUT);
-            timeout_timer.async_wait([this](const boost::system::error_code& error){ if (!error) { std::lock_guard<std::mutex> lock(timeout_lock); timeout_triggered = true; } });
-            timeout_lock.unlock();
-        }
-        else if (timeout_triggered)
+    if (ping_pending)
+    {
+        if (now - ping_sent >= xdccd::connection::PONG_TIMEOUT)
         {
+            BOOST_LOG_TRIVIAL(error) << "No answer from " << host << " for " << std::chrono::duration_cast<std::chrono::seconds>(now - last_activity).count() << "s, reconnecting ...";
+            state = connection::IDLE;
             socket->close();
-
-            timeout_lock.lock();
-            timeout_triggered = false;
-            timeout_lock.unlock();
-
             start_reconnect_timer();
+            return;
         }
     }
+    else if (now - last_activity >= xdccd::connection::PING_IDLE_TIME)
+    {
+        // Anything the server sends counts as an answer, including its PONG
+        write("PING :" + host);
+        ping_pending = true;
+        ping_sent = now;
+    }
+
+    start_keepalive_timer();
 }
 
 void xdccd::IRCConnection::read(const boost::system::error_code& error, std::size_t count)
 {
     if (!error)
     {
-        timeout_lock.lock();
-        message_received = true;
-        timeout_lock.unlock();
+        last_activity = std::chrono::steady_clock::now();
+        ping_pending = false;
 
         bytes_read += count;
 
@@ -133,10 +166,12 @@ void xdccd::IRCConnection::read(const boost::system::error_code& error, std::siz
         reconnect_delay = xdccd::connection::MIN_RECONNECT_DELAY;
 
         boost::asio::streambuf::const_buffers_type bufs = msg_buffer.data();
-        read_handler(
-                std::string(boost::asio::buffers_begin(bufs),
-                            boost::asio::buffers_begin(bufs) + count - 2)
-                );
+        std::string line(boost::asio::buffers_begin(bufs), boost::asio::buffers_begin(bufs) + count - 2);
+
+        if (recorder)
+            recorder->record(line);
+
+        read_handler(line);
 
         msg_buffer.consume(count);
 
@@ -151,12 +186,20 @@ void xdccd::IRCConnection::read(const boost::system::error_code& error, std::siz
     else
     {
         BOOST_LOG_TRIVIAL(error) << "Read error: " << error.message();
+
+        // Nothing left to keep alive until we are reconnected
+        state = connection::IDLE;
+        keepalive_timer.cancel();
         start_reconnect_timer();
     }
 }
 
 void xdccd::IRCConnection::write(const std::string &message)
 {
+    // Still waiting for the scheduler to let us connect
+    if (!socket)
+        return;
+
     socket->async_write(boost::asio::buffer(message + "\r\n"),
             [this](const boost::system::error_code &error, std::size_t bytes_transferred)
             {
@@ -173,16 +216,23 @@ void xdccd::IRCConnection::write(const std::string &message)
 
 void xdccd::IRCConnection::close()
 {
-    std::lock_guard<std::mutex> lock(io_lock);
+    // Give back our slot in the connection scheduler, if we hold or wait for one
+    if (connect_pending.exchange(false) && !scheduler.cancel(host, connect_ticket))
+        scheduler.release(host);
+
+    io_service.post([this]()
+    {
+        if (recorder)
+            recorder->flush();
 
-    std::lock_guard<std::mutex> time_lock(timeout_lock);
-    message_received = false;
-    timeout_triggered = false;
-    timeout_timer.cancel();
-    reconnect_timer.cancel();
+        keepalive_timer.cancel();
+        reconnect_timer.cancel();
 
+        if (socket)
+            socket->close();
 
-    io_service.post([this]() { socket->close(); io_service.stop(); });
+        io_service.stop();
+    });
 }
 
 void xdccd::IRCConnection::start_reconnect_timer()
@@ -190,13 +240,12 @@ void xdccd::IRCConnection::start_reconnect_timer()
     if (reconnect_timer.expires_from_now() > std::chrono::milliseconds::zero())
         return;
 
-    std::lock_guard<std::mutex> lock(timeout_lock);
-    reconnect_delay = reconnect_delay == std::chrono::milliseconds::zero() ? xdccd::connection::MIN_RECONNECT_DELAY : reconnect_delay * 2;
+    reconnect_delay = scheduler.next_delay(reconnect_delay);
 
     BOOST_LOG_TRIVIAL(info) << "Trying to reconnect again in " << reconnect_delay.count() << "ms ...";
 
     reconnect_timer.expires_from_now(reconnect_delay);
-    reconnect_timer.async_wait([this](const boost::system::error_code& error){ if (!error) { BOOST_LOG_TRIVIAL(info) << "Reconnecting ..."; this->connect(); } else { BOOST_LOG_TRIVIAL(info) << "Error reconnecting!"; } });
+    reconnect_timer.async_wait([this](const boost::system::error_code& error){ if (!error) { BOOST_LOG_TRIVIAL(info) << "Reconnecting ..."; this->schedule_connect(); } else { BOOST_LOG_TRIVIAL(info) << "Error reconnecting!"; } });
 }
 
 void xdccd::IRCConnection::set_read_handler(const read_handler_t &handler)
@@ -209,6 +258,28 @@ void xdccd::IRCConnection::set_write_handler(const write_handler_t &handler)
     write_handler = handler;
 }
 
+void xdccd::IRCConnection::set_priority_handler(const priority_handler_t &handler)
+{
+    priority_handler = handler;
+}
+
+void xdccd::IRCConnection::set_socket_factory(const socket_factory_t &factory)
+{
+    socket_factory = factory;
+}
+
+void xdccd::IRCConnection::set_recorder(TrafficRecorderPtr new_recorder)
+{
+    // The recorder is only used from within the io_service
+    io_service.post([this, new_recorder]()
+    {
+        if (recorder)
+            recorder->flush();
+
+        recorder = new_recorder;
+    });
+}
+
 const std::string &xdccd::IRCConnection::get_host() const
 {
     return host;
@@ -219,6 +290,11 @@ const std::string &xdccd::IRCConnection::get_port() const
     return port;
 }
 
+boost::asio::io_service &xdccd::IRCConnection::get_io_service()
+{
+    return io_service;
+}
+
 std::string xdccd::IRCConnection::get_local_ip() const
 {
     return socket->get_address();
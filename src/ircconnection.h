@@ -1,12 +1,15 @@
 #pragma once
 
 #include <functional>
-#include <mutex>
 #include <chrono>
+#include <atomic>
 #include <boost/asio.hpp>
 #include <boost/asio/system_timer.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include "socket.h"
+#include "connectionscheduler.h"
+#include "trafficrecorder.h"
 
 namespace xdccd
 {
@@ -14,12 +17,19 @@ namespace xdccd
 typedef std::function<void (const std::string&)> read_handler_t;
 typedef std::function<void (void)> write_handler_t;
 typedef std::function<void (void)> connected_handler_t;
+typedef std::function<std::unique_ptr<Socket> (boost::asio::io_service&)> socket_factory_t;
 
 namespace connection
 {
 static const std::chrono::milliseconds MIN_RECONNECT_DELAY(500);
 static const std::chrono::seconds MAX_RECONNECT_DELAY(120);
-static const std::chrono::seconds READ_TIMEOUT(120);
+
+// Interval of the keepalive timer
+static const std::chrono::seconds KEEPALIVE_INTERVAL(5);
+// Send a PING after this long without receiving anything
+static const std::chrono::seconds PING_IDLE_TIME(15);
+// Reconnect if the server doesn't answer our PING in time
+static const std::chrono::seconds PONG_TIMEOUT(10);
 
 enum STATE
 {
@@ -32,7 +42,8 @@ enum STATE
 class IRCConnection
 {
     public:
-        IRCConnection(const std::string &host, std::string port, const read_handler_t &read_handler, const connected_handler_t &connected_handler, bool use_ssl);
+        IRCConnection(const std::string &host, std::string port, const read_handler_t &read_handler, const connected_handler_t &connected_handler, SSLContextPtr ssl_context, ConnectionScheduler &scheduler);
+        void schedule_connect();
         void connect();
         void on_resolved(const boost::system::error_code& err, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
         void run();
@@ -42,26 +53,47 @@ class IRCConnection
         void start_reconnect_timer();
         void set_read_handler(const read_handler_t &handler);
         void set_write_handler(const write_handler_t &handler);
+        void set_priority_handler(const priority_handler_t &handler);
+
+        // Replaces the plain/SSL socket, e.g. with a fake one for replaying recordings
+        void set_socket_factory(const socket_factory_t &factory);
+
+        // Records all received lines, pass nullptr to stop recording
+        void set_recorder(TrafficRecorderPtr recorder);
         const std::string &get_host() const;
         const std::string &get_port() const;
         std::string get_local_ip() const;
         connection::STATE get_state() const;
 
+        // The io_service our handlers run on, for work that should not run
+        // concurrently with them
+        boost::asio::io_service &get_io_service();
+
     private:
+        void finish_connect();
+        void start_keepalive_timer();
+        void on_keepalive(const boost::system::error_code &error);
+
         std::string host;
         std::string port;
-        bool use_ssl;
+        SSLContextPtr ssl_context;
         connection::STATE state;
 
-        std::mutex io_lock;
         boost::asio::io_service io_service;
         boost::asio::ip::tcp::resolver resolver;
         std::unique_ptr<boost::asio::io_service::work> work;
         std::unique_ptr<xdccd::Socket> socket;
+        socket_factory_t socket_factory;
+        TrafficRecorderPtr recorder;
 
         read_handler_t read_handler;
         write_handler_t write_handler;
         connected_handler_t connected_handler;
+        priority_handler_t priority_handler;
+
+        ConnectionScheduler &scheduler;
+        connect_ticket_t connect_ticket;
+        std::atomic<bool> connect_pending;
 
         std::size_t bytes_read;
         std::size_t bytes_written;
@@ -70,11 +102,13 @@ class IRCConnection
         std::string partial_msg;
 
         std::chrono::milliseconds reconnect_delay;
-        boost::asio::system_timer timeout_timer;
         boost::asio::system_timer reconnect_timer;
-        bool message_received;
-        bool timeout_triggered;
-        std::mutex timeout_lock;
+
+        // Only touched from within the io_service
+        boost::asio::steady_timer keepalive_timer;
+        std::chrono::steady_clock::time_point last_activity;
+        std::chrono::steady_clock::time_point ping_sent;
+        bool ping_pending;
 };
 
 }
@@ -1,9 +1,62 @@
 #include <regex>
+#include <array>
+#include <cctype>
+#include <unordered_map>
 
 #include "ircmessage.h"
 
+namespace
+{
+    const std::array<std::pair<const char*, xdccd::irc::Command>, 13> COMMAND_NAMES
+    {{
+        { "PING", xdccd::irc::PING },
+        { "PONG", xdccd::irc::PONG },
+        { "PRIVMSG", xdccd::irc::PRIVMSG },
+        { "NOTICE", xdccd::irc::NOTICE },
+        { "JOIN", xdccd::irc::JOIN },
+        { "PART", xdccd::irc::PART },
+        { "KICK", xdccd::irc::KICK },
+        { "QUIT", xdccd::irc::QUIT },
+        { "NICK", xdccd::irc::NICK },
+        { "MODE", xdccd::irc::MODE },
+        { "TOPIC", xdccd::irc::TOPIC },
+        { "INVITE", xdccd::irc::INVITE },
+        { "ERROR", xdccd::irc::ERROR }
+    }};
+}
+
+xdccd::irc::Command xdccd::irc::parse_command(const std::string &command)
+{
+    // Numeric replies always consist of exactly three digits
+    if (command.size() == 3 && std::isdigit(command[0]) && std::isdigit(command[1]) && std::isdigit(command[2]))
+        return static_cast<Command>((command[0] - '0') * 100 + (command[1] - '0') * 10 + (command[2] - '0'));
+
+    static const std::unordered_map<std::string, Command> commands(COMMAND_NAMES.begin(), COMMAND_NAMES.end());
+
+    auto it = commands.find(command);
+    if (it == commands.end())
+        return UNKNOWN;
+
+    return it->second;
+}
+
+std::string xdccd::irc::command_name(Command command)
+{
+    if (command < UNKNOWN)
+    {
+        std::string number = std::to_string(static_cast<int>(command));
+        return std::string(3 - number.size(), '0') + number;
+    }
+
+    for (auto &name : COMMAND_NAMES)
+        if (name.second == command)
+            return name.first;
+
+    return "UNKNOWN";
+}
+
 xdccd::IRCMessage::IRCMessage(const std::string &message)
-    : ctcp(false), raw(message)
+    : code(irc::UNKNOWN), ctcp(false), raw(message)
 {
     static std::regex strip_color("\\x1f|\\x02|\\x12|\\x0f|\\x16|\\x03(?:\\d{1,2}(?:,\\d{1,2})?)?", std::regex_constants::ECMAScript);
 
@@ -27,6 +80,7 @@ xdccd::IRCMessage::IRCMessage(const std::string &message)
     // Parse command
     space_pos = msg.find(' ');
     command = msg.substr(0, space_pos);
+    code = irc::parse_command(command);
     msg.erase(0, space_pos + 1);
 
     // In case there's a trailing parameter, store it for later
@@ -46,7 +100,7 @@ xdccd::IRCMessage::IRCMessage(const std::string &message)
         params.push_back(trailing);
 
     // Parse CTCP messages
-    if (command == "PRIVMSG")
+    if (code == irc::PRIVMSG)
     {
         if(params[1][0] == 0x01 && params[1][params[1].length()-1] == 0x01)
         {
@@ -1,9 +1,44 @@
 #pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
 #include <boost/algorithm/string.hpp>
 
 namespace xdccd
 {
 
+namespace irc
+{
+enum Command : std::uint16_t
+{
+    // Numeric replies are stored as their number (000-999)
+    RPL_WELCOME = 1,
+    RPL_ENDOFNAMES = 366,
+    ERR_ERRONEUSNICKNAME = 432,
+    ERR_NICKNAMEINUSE = 433,
+
+    UNKNOWN = 1000,
+    PING,
+    PONG,
+    PRIVMSG,
+    NOTICE,
+    JOIN,
+    PART,
+    KICK,
+    QUIT,
+    NICK,
+    MODE,
+    TOPIC,
+    INVITE,
+    ERROR,
+
+    COMMAND_COUNT
+};
+
+Command parse_command(const std::string &command);
+std::string command_name(Command command);
+}
+
 class IRCMessage
 {
     public:
@@ -12,6 +47,7 @@ class IRCMessage
         std::string prefix;
         std::string nickname;
         std::string command;
+        irc::Command code;
         std::vector<std::string> params;
         bool ctcp;
         std::string ctcp_command;
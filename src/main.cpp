@@ -78,6 +78,31 @@ int main(int argc, char* argv[])
     bool enable_webinterface = config["api"].get("enable_webinterface", true).asBool();
     xdccd::API api(bind_address, port, download_path, enable_webinterface);
 
+    // Bound the announces kept in memory, sizes are given like in announces
+    Json::Value announce_limits = config["announces"];
+    if (announce_limits.isObject())
+    {
+        xdccd::AnnounceLimits limits;
+
+        if (announce_limits.isMember("max_age"))
+            limits.max_age = std::chrono::seconds(announce_limits["max_age"].asUInt());
+
+        if (announce_limits.isMember("cold_age"))
+            limits.cold_age = std::chrono::seconds(announce_limits["cold_age"].asUInt());
+
+        if (announce_limits.isMember("max_bot_memory"))
+            limits.max_bot_memory = xdccd::store::parse_size(announce_limits["max_bot_memory"].asString()) * 1024;
+
+        if (announce_limits.isMember("max_memory"))
+            limits.max_memory = xdccd::store::parse_size(announce_limits["max_memory"].asString()) * 1024;
+
+        api.get_bot_manager().get_announce_sweeper().set_limits(limits);
+    }
+
+    // Rules for downloading releases as soon as they are announced
+    if (!config["watchlist_file"].isNull())
+        api.get_bot_manager().get_watch_list().persist(config["watchlist_file"].asString());
+
     // Start bots defined in config file
     Json::Value bots = config["bots"];
     if (!bots.isNull())
@@ -108,7 +133,19 @@ int main(int argc, char* argv[])
                 for(auto channel : bot["channels"])
                     channels.push_back(channel.asString());
 
-            api.get_bot_manager().launch_bot(host, port, bot_name, channels, ssl, api.get_download_manager());
+            xdccd::DCCBotPtr dcc_bot = api.get_bot_manager().launch_bot(host, port, bot_name, channels, ssl, api.get_download_manager());
+
+            // Record the bot's raw traffic, e.g. for replaying it with xdccd-replay
+            if (!bot["record"].isNull())
+                dcc_bot->record_traffic(bot["record"].asString());
+
+            // Keep the bot's announces across restarts, as long as they would be kept in memory
+            if (!bot["announces_file"].isNull())
+                dcc_bot->persist_announces(bot["announces_file"].asString(), api.get_bot_manager().get_announce_sweeper().get_limits().max_age);
+
+            // Ask announcing bots for all of their packs, not just the announced ones
+            if (bot.get("pack_lists", false).asBool())
+                dcc_bot->request_pack_lists();
         }
     }
 
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <limits>
+
+#include "packlist.h"
+
+namespace
+{
+    template <typename T>
+    T parse_number(const char *begin, const char *end)
+    {
+        // Only digits, as matched by the announce regex
+        unsigned long long value = 0;
+        for (const char *c = begin; c != end && value <= std::numeric_limits<T>::max(); ++c)
+            value = value * 10 + (*c - '0');
+
+        return static_cast<T>(std::min<unsigned long long>(value, std::numeric_limits<T>::max()));
+    }
+}
+
+std::size_t xdccd::parse_pack_list(const std::string &data, const std::regex &announce_regex, const std::string &bot_name, const std::string &channel, timestamp_t seen, std::vector<AnnounceRow> &rows)
+{
+    std::size_t count = 0;
+    std::cmatch m;
+
+    const char *end = data.data() + data.size();
+    for (const char *line = data.data(); line < end; )
+    {
+        const char *line_end = std::find(line, end, '\n');
+        const char *next = line_end == end ? end : line_end + 1;
+
+        // Lists are often indented, and might use Windows line endings
+        while (line < line_end && (*line == ' ' || *line == '\t'))
+            ++line;
+
+        while (line_end > line && (line_end[-1] == '\r' || line_end[-1] == ' '))
+            --line_end;
+
+        if (std::regex_match(line, line_end, m, announce_regex) && m.size() == 5)
+        {
+            AnnounceRow row;
+            row.bot_name = StringRef{bot_name.data(), bot_name.size()};
+            row.channel = StringRef{channel.data(), channel.size()};
+            row.slot = parse_number<std::uint16_t>(m[1].first, m[1].second);
+            row.download_count = parse_number<std::uint32_t>(m[2].first, m[2].second);
+            row.size = StringRef{m[3].first, static_cast<std::size_t>(m[3].length())};
+            row.num_size = xdccd::store::parse_size(m[3].str());
+            row.filename = StringRef{m[4].first, static_cast<std::size_t>(m[4].length())};
+            row.last_seen = seen;
+
+            rows.push_back(row);
+            count++;
+        }
+
+        line = next;
+    }
+
+    return count;
+}
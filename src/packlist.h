@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "announcestore.h"
+
+namespace xdccd
+{
+
+namespace packlist
+{
+// The pack list of a bot is requested again after this long
+static const std::chrono::hours REFRESH_INTERVAL(6);
+
+// Pack lists are requested one at a time, at most one per interval, so the
+// server does not take us for flooding
+static const std::chrono::seconds REQUEST_INTERVAL(30);
+
+// Files offered by a bot this long after we asked for its list are not
+// taken for the list anymore
+static const std::chrono::minutes REQUEST_TIMEOUT(2);
+
+// Lists are received into memory, larger ones are declined
+static const std::size_t MAX_SIZE(16 * 1024 * 1024);
+}
+
+// Parses a pack list, as sent by bots in reply to "xdcc list", in a single
+// pass over data. Every line is matched against announce_regex like an
+// announce in the channel, anything else is skipped. Rows are appended to
+// rows and point into data, bot_name and channel. Returns the number of
+// packs found.
+std::size_t parse_pack_list(const std::string &data, const std::regex &announce_regex, const std::string &bot_name, const std::string &channel, timestamp_t seen, std::vector<AnnounceRow> &rows);
+
+}
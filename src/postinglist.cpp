@@ -0,0 +1,181 @@
+#include <algorithm>
+
+#include "postinglist.h"
+
+xdccd::CompressedPostingList::Iterator::Iterator(const CompressedPostingList &list)
+    : pos(list.data.data()), end(list.data.data() + list.data.size()), current(0), is_valid(true)
+{
+    next();
+}
+
+bool xdccd::CompressedPostingList::Iterator::valid() const
+{
+    return is_valid;
+}
+
+xdccd::announce_id_t xdccd::CompressedPostingList::Iterator::value() const
+{
+    return current;
+}
+
+void xdccd::CompressedPostingList::Iterator::next()
+{
+    if (pos == end)
+    {
+        is_valid = false;
+        return;
+    }
+
+    announce_id_t delta = 0;
+    unsigned int shift = 0;
+
+    while (*pos & 0x80)
+    {
+        delta |= static_cast<announce_id_t>(*pos++ & 0x7f) << shift;
+        shift += 7;
+    }
+
+    delta |= static_cast<announce_id_t>(*pos++) << shift;
+    current += delta;
+}
+
+void xdccd::CompressedPostingList::Iterator::skip_to(announce_id_t target)
+{
+    while (is_valid && current < target)
+        next();
+}
+
+xdccd::CompressedPostingList::CompressedPostingList()
+    : last(0), count(0)
+{}
+
+void xdccd::CompressedPostingList::add(announce_id_t id)
+{
+    // The first delta is relative to 0
+    if (count == 0 || id > last)
+    {
+        append(id - last);
+        last = id;
+        count++;
+        return;
+    }
+
+    // Out of order inserts are rare (renamed announces), just re-encode
+    std::vector<announce_id_t> ids;
+    decode(ids);
+
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it != ids.end() && *it == id)
+        return;
+
+    ids.insert(it, id);
+    encode(ids);
+}
+
+void xdccd::CompressedPostingList::remove(announce_id_t id)
+{
+    std::vector<announce_id_t> ids;
+    decode(ids);
+
+    auto it = std::lower_bound(ids.begin(), ids.end(), id);
+    if (it == ids.end() || *it != id)
+        return;
+
+    ids.erase(it);
+    encode(ids);
+}
+
+void xdccd::CompressedPostingList::concat(const CompressedPostingList &other)
+{
+    if (other.empty())
+        return;
+
+    // Only the first delta of other changes, the rest can be copied as is
+    auto pos = other.data.begin();
+    announce_id_t first = 0;
+    unsigned int shift = 0;
+
+    while (*pos & 0x80)
+    {
+        first |= static_cast<announce_id_t>(*pos++ & 0x7f) << shift;
+        shift += 7;
+    }
+
+    first |= static_cast<announce_id_t>(*pos++) << shift;
+
+    append(first - last);
+    data.insert(data.end(), pos, other.data.end());
+
+    last = other.last;
+    count += other.count;
+}
+
+std::size_t xdccd::CompressedPostingList::size() const
+{
+    return count;
+}
+
+std::size_t xdccd::CompressedPostingList::get_memory_usage() const
+{
+    return sizeof(*this) + data.capacity();
+}
+
+bool xdccd::CompressedPostingList::empty() const
+{
+    return count == 0;
+}
+
+void xdccd::CompressedPostingList::decode(std::vector<announce_id_t> &result) const
+{
+    result.clear();
+    result.reserve(count);
+
+    for (Iterator it(*this); it.valid(); it.next())
+        result.push_back(it.value());
+}
+
+void xdccd::CompressedPostingList::encode(const std::vector<announce_id_t> &ids)
+{
+    data.clear();
+    last = 0;
+    count = 0;
+
+    for (announce_id_t id : ids)
+    {
+        append(id - last);
+        last = id;
+        count++;
+    }
+
+    data.shrink_to_fit();
+}
+
+void xdccd::CompressedPostingList::append(announce_id_t delta)
+{
+    while (delta >= 0x80)
+    {
+        data.push_back(static_cast<std::uint8_t>((delta & 0x7f) | 0x80));
+        delta >>= 7;
+    }
+
+    data.push_back(static_cast<std::uint8_t>(delta));
+}
+
+void xdccd::intersect(std::vector<announce_id_t> &ids, const CompressedPostingList &list)
+{
+    CompressedPostingList::Iterator it(list);
+    auto out = ids.begin();
+
+    for (announce_id_t id : ids)
+    {
+        it.skip_to(id);
+
+        if (!it.valid())
+            break;
+
+        if (it.value() == id)
+            *out++ = id;
+    }
+
+    ids.erase(out, ids.end());
+}
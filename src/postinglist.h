@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace xdccd
+{
+
+typedef std::uint32_t announce_id_t;
+
+// Sorted list of announce IDs, stored as varint encoded deltas
+class CompressedPostingList
+{
+    public:
+        class Iterator
+        {
+            public:
+                Iterator(const CompressedPostingList &list);
+
+                bool valid() const;
+                announce_id_t value() const;
+                void next();
+
+                // Advances to the first ID >= target
+                void skip_to(announce_id_t target);
+
+            private:
+                const std::uint8_t *pos;
+                const std::uint8_t *end;
+                announce_id_t current;
+                bool is_valid;
+        };
+
+        CompressedPostingList();
+
+        void add(announce_id_t id);
+        void remove(announce_id_t id);
+
+        // Appends all IDs of other, which have to be higher than the ones in this list
+        void concat(const CompressedPostingList &other);
+
+        std::size_t size() const;
+        std::size_t get_memory_usage() const;
+        bool empty() const;
+
+        void decode(std::vector<announce_id_t> &result) const;
+        void encode(const std::vector<announce_id_t> &ids);
+
+    private:
+        void append(announce_id_t delta);
+
+        std::vector<std::uint8_t> data;
+        announce_id_t last;
+        std::uint32_t count;
+};
+
+// Intersects the sorted list ids with the compressed list, in place
+void intersect(std::vector<announce_id_t> &ids, const CompressedPostingList &list);
+
+}
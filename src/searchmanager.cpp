@@ -1,112 +1,957 @@
 #include <boost/log/trivial.hpp>
 #include <boost/algorithm/string.hpp>
 #include <cctype>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <queue>
+#include <set>
 
 #include "logging.h"
 #include "searchmanager.h"
 #include "botmanager.h"
+#include "stringmatch.h"
 
-xdccd::SearchResultItem::SearchResultItem(DCCAnnouncePtr announce, unsigned int score)
-    : announce(announce), score(score)
+namespace
+{
+    // Higher scores first, ties are broken by release. As this doesn't
+    // depend on where a release is offered, every bot's best k releases
+    // contain all sources of the overall best k.
+    bool ranks_before(const xdccd::SearchResultItem &x, const xdccd::SearchResultItem &y)
+    {
+        if (x.score != y.score)
+            return x.score > y.score;
+
+        return x.release < y.release;
+    }
+
+    typedef std::pair<xdccd::release_t, xdccd::announce_id_t> copy_t;
+}
+
+const char *xdccd::search::job_state_name(JobState state)
+{
+    switch (state)
+    {
+        case RUNNING:
+            return "running";
+        case FINISHED:
+            return "finished";
+        case CANCELLED:
+            return "cancelled";
+        case FAILED:
+            return "failed";
+    }
+
+    return "unknown";
+}
+
+xdccd::SearchResultItem::SearchResultItem(release_t release, unsigned int score)
+    : release(release), score(score)
+{}
+
+xdccd::SearchOptions::SearchOptions()
+    : fuzzy(false)
 {}
 
-xdccd::SearchResult::SearchResult(std::size_t total_results, std::size_t result_start)
-    : total_results(total_results), result_start(result_start)
+bool xdccd::SearchOptions::is_filtered() const
+{
+    return !filter.is_empty() || !networks.empty();
+}
+
+xdccd::ResultSet::ResultSet()
+    : total(0)
 {}
 
-xdccd::CacheEntry::CacheEntry(const std::string &query, std::vector<SearchResultItemPtr> results)
-    : query(query), results(std::move(results)), created(std::chrono::system_clock::now())
+xdccd::DCCAnnouncePtr xdccd::ResultSet::get(const SearchResultItem &item) const
+{
+    return get(item.sources.front());
+}
+
+xdccd::DCCAnnouncePtr xdccd::ResultSet::get(const ReleaseSource &source) const
+{
+    return snapshots[source.shard]->get(source.id);
+}
+
+bool xdccd::ResultSet::is_complete() const
+{
+    return items.size() == total;
+}
+
+std::size_t xdccd::ResultSet::get_memory_usage() const
+{
+    std::size_t usage = sizeof(*this) + snapshots.capacity() * sizeof(AnnounceSnapshotPtr) + items.capacity() * sizeof(SearchResultItem);
+    for (auto &item : items)
+        usage += item.sources.capacity() * sizeof(ReleaseSource);
+
+    return usage;
+}
+
+bool xdccd::SearchRequest::is_empty() const
+{
+    return terms.empty() && !options.is_filtered();
+}
+
+xdccd::SearchJob::SearchJob(search_job_id_t id, std::size_t k)
+    : id(id), k(k), state(xdccd::search::RUNNING), finished_shards(0), cancelled(false)
+{}
+
+xdccd::search_job_id_t xdccd::SearchJob::get_id() const
+{
+    return id;
+}
+
+xdccd::search::JobState xdccd::SearchJob::get_state() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return state;
+}
+
+std::size_t xdccd::SearchJob::get_finished_shards() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return finished_shards;
+}
+
+std::size_t xdccd::SearchJob::get_shards() const
+{
+    return request.snapshots.size();
+}
+
+xdccd::ResultSetPtr xdccd::SearchJob::get_results() const
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return results;
+}
+
+void xdccd::SearchJob::cancel()
+{
+    cancelled = true;
+}
+
+bool xdccd::SearchJob::is_cancelled() const
+{
+    return cancelled;
+}
+
+xdccd::SearchResult::SearchResult(ResultSetPtr results, std::size_t result_start, std::size_t limit)
+    : total_results(results->total), result_start(result_start), results(results)
+{
+    std::size_t first = std::min(result_start, results->items.size());
+    std::size_t last = first + std::min(results->items.size() - first, limit);
+
+    begin = results->items.begin() + first;
+    end = results->items.begin() + last;
+}
+
+xdccd::SearchManager::SearchManager(std::size_t max_cache_memory)
+    : max_cache_memory(max_cache_memory), cache_memory(0), hits(0), misses(0), invalidations(0), evictions(0), negative_hits(0), last_job_id(0), running_jobs(0),
+    workers(std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), xdccd::search::MAX_WORKER_THREADS))
 {}
 
-xdccd::SearchResultPtr xdccd::SearchManager::search(xdccd::BotManager &manager, const std::string &query, std::size_t start, std::size_t limit)
+xdccd::SearchResultPtr xdccd::SearchManager::search(xdccd::BotManager &manager, const std::string &query, std::size_t start, std::size_t limit, const SearchOptions &options)
+{
+    return search(manager.get_bots(), query, start, limit, options);
+}
+
+xdccd::SearchResultPtr xdccd::SearchManager::search(const std::vector<xdccd::DCCBotPtr> &bots, const std::string &query, std::size_t start, std::size_t limit, const SearchOptions &options)
+{
+    SearchRequest request;
+    prepare(bots, query, options, request);
+
+    std::size_t needed = limit > std::numeric_limits<std::size_t>::max() - start ? std::numeric_limits<std::size_t>::max() : start + limit;
+    ResultSetPtr results = request.cacheable ? lookup(request.key, request.versions, needed) : nullptr;
+
+    if (!results)
+    {
+        std::size_t k = get_kept_results(needed);
+        std::size_t shards = request.snapshots.size();
+        std::vector<std::vector<SearchResultItem>> tops(shards);
+        std::vector<std::vector<release_t>> releases(shards);
+        std::vector<std::size_t> counts(shards, 0);
+
+        bool negative = is_negative_cacheable(request) && lookup_negative(request);
+        if (!negative && !request.is_empty())
+        {
+            for_each_shard(shards, [&](std::size_t shard)
+            {
+                counts[shard] = search_in_announces(static_cast<std::uint32_t>(shard), *request.snapshots[shard], request.terms, request.options, k, tops[shard], shards > 1 ? &releases[shard] : nullptr);
+            });
+        }
+
+        results = merge(request, tops, count_releases(releases, counts), k);
+
+        // Empty results would be outdated by the next announce of any bot
+        if (results->total == 0 && is_negative_cacheable(request))
+        {
+            if (!negative)
+                insert_negative(request);
+        }
+        else if (request.cacheable)
+            insert(request.key, request.versions, results);
+    }
+
+    return std::make_shared<SearchResult>(results, start, limit);
+}
+
+xdccd::SearchJobPtr xdccd::SearchManager::submit(xdccd::BotManager &manager, const std::string &query, std::size_t limit, const SearchOptions &options)
+{
+    return submit(manager.get_bots(), query, limit, options);
+}
+
+xdccd::SearchJobPtr xdccd::SearchManager::submit(const std::vector<xdccd::DCCBotPtr> &bots, const std::string &query, std::size_t limit, const SearchOptions &options)
+{
+    search_job_id_t id;
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_lock);
+        prune_jobs();
+
+        if (running_jobs >= xdccd::search::MAX_RUNNING_JOBS)
+            return nullptr;
+
+        running_jobs++;
+        id = ++last_job_id;
+    }
+
+    // Nobody else knows about the job until it is added to jobs
+    auto job = std::make_shared<SearchJob>(id, get_kept_results(limit));
+    prepare(bots, query, options, job->request);
+
+    std::size_t shards = job->request.snapshots.size();
+    job->tops.resize(shards);
+    job->releases.resize(shards);
+    job->counts.resize(shards, 0);
+
+    ResultSetPtr cached = job->request.cacheable ? lookup(job->request.key, job->request.versions, limit) : nullptr;
+    job->results = cached ? cached : merge(job->request, job->tops, 0, job->k);
+
+    bool negative = !cached && is_negative_cacheable(job->request) && lookup_negative(job->request);
+    bool done = cached || negative || shards == 0 || job->request.is_empty();
+    if (done)
+    {
+        job->finished_shards = shards;
+        finish_job(*job, false);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_lock);
+        jobs[id] = job;
+    }
+
+    if (!done)
+    {
+        for (std::size_t shard = 0; shard < shards; ++shard)
+            workers.post([this, job, shard]() { run_shard(job, shard); });
+    }
+
+    return job;
+}
+
+xdccd::SearchJobPtr xdccd::SearchManager::get_job(search_job_id_t id)
+{
+    std::lock_guard<std::mutex> lock(jobs_lock);
+
+    auto it = jobs.find(id);
+    return it != jobs.end() ? it->second : nullptr;
+}
+
+std::size_t xdccd::SearchManager::get_running_jobs()
+{
+    return running_jobs;
+}
+
+void xdccd::SearchManager::prepare(const std::vector<xdccd::DCCBotPtr> &bots, const std::string &query, const SearchOptions &options, SearchRequest &request) const
+{
+    request.terms = normalize(query);
+    request.options = options;
+    request.key = boost::algorithm::join(request.terms, " ");
+
+    // Terms never contain whitespace, so this can't clash with an exact query
+    if (options.fuzzy)
+        request.key = "\t" + request.key;
+
+    if (!options.filter.is_empty())
+        request.key += "\t" + options.filter.to_string();
+
+    for (auto &network : options.networks)
+        request.key += "\tnetwork:" + fold_case(network);
+
+    // Pin the current version of every bot's announces
+    for (auto &bot : bots)
+    {
+        if (!options.networks.empty() && std::none_of(options.networks.begin(), options.networks.end(), [&bot](const std::string &network) { return boost::algorithm::iequals(network, bot->get_host()); }))
+            continue;
+
+        request.snapshots.push_back(bot->get_announces());
+        request.versions.push_back(std::make_pair(bot->get_id(), request.snapshots.back()->get_generation()));
+    }
+
+    request.cacheable = options.filter.max_age == 0;
+}
+
+std::size_t xdccd::SearchManager::get_kept_results(std::size_t needed)
+{
+    // Keep twice as many results each time someone pages past the end,
+    // so paging through everything only searches a few times
+    std::size_t k = xdccd::search::CACHED_RESULTS;
+    while (k < needed)
+        k = k > std::numeric_limits<std::size_t>::max() / 2 ? needed : k * 2;
+
+    return k;
+}
+
+xdccd::ResultSetPtr xdccd::SearchManager::merge(const SearchRequest &request, const std::vector<std::vector<SearchResultItem>> &tops, std::size_t total, std::size_t k)
+{
+    auto result_set = std::make_shared<ResultSet>();
+    std::vector<SearchResultItem> &items = result_set->items;
+    result_set->total = total;
+
+    if (tops.size() == 1)
+        items = tops[0];
+    else
+    {
+        std::vector<SearchResultItem> found;
+        for (auto &top : tops)
+            found.insert(found.end(), top.begin(), top.end());
+
+        // Join the sources of releases found in several shards. The
+        // sort is stable, so sources stay sorted by shard.
+        std::stable_sort(found.begin(), found.end(), [](const SearchResultItem &x, const SearchResultItem &y) { return x.release < y.release; });
+
+        for (auto &item : found)
+        {
+            if (!items.empty() && items.back().release == item.release)
+                items.back().sources.insert(items.back().sources.end(), item.sources.begin(), item.sources.end());
+            else
+                items.push_back(std::move(item));
+        }
+    }
+
+    std::sort(items.begin(), items.end(), ranks_before);
+    if (items.size() > k)
+        items.erase(items.begin() + k, items.end());
+
+    items.shrink_to_fit();
+    result_set->snapshots = request.snapshots;
+
+    return result_set;
+}
+
+std::size_t xdccd::SearchManager::count_releases(const std::vector<std::vector<release_t>> &releases, const std::vector<std::size_t> &counts)
 {
+    if (counts.size() < 2)
+        return counts.empty() ? 0 : counts[0];
+
+    // Releases offered by several bots are only counted once. The releases
+    // of every bot are sorted, so merging them brings duplicates together.
+    typedef std::pair<release_t, std::size_t> head_t;
+    std::priority_queue<head_t, std::vector<head_t>, std::greater<head_t>> heads;
+    std::vector<std::size_t> positions(releases.size(), 0);
+
+    for (std::size_t shard = 0; shard < releases.size(); ++shard)
+    {
+        if (!releases[shard].empty())
+            heads.emplace(releases[shard][0], shard);
+    }
+
+    std::size_t total = 0;
+    release_t last = 0;
+
+    while (!heads.empty())
+    {
+        head_t head = heads.top();
+        heads.pop();
+
+        if (total == 0 || head.first != last)
+        {
+            total++;
+            last = head.first;
+        }
+
+        std::size_t &position = positions[head.second];
+        if (++position < releases[head.second].size())
+            heads.emplace(releases[head.second][position], head.second);
+    }
+
+    return total;
+}
+
+void xdccd::SearchManager::run_shard(SearchJobPtr job, std::size_t shard)
+{
+    std::vector<SearchResultItem> top;
+    std::vector<release_t> releases;
+    std::size_t count = 0;
+    bool failed = false;
+
+    if (!job->is_cancelled())
+    {
+        try
+        {
+            count = search_in_announces(static_cast<std::uint32_t>(shard), *job->request.snapshots[shard], job->request.terms, job->request.options, job->k, top, job->tops.size() > 1 ? &releases : nullptr);
+        }
+        catch (const std::exception &e)
+        {
+            BOOST_LOG_TRIVIAL(error) << "Search job #" << job->id << " failed: " << e.what();
+            failed = true;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(job->lock);
+
+    if (failed)
+        job->state = xdccd::search::FAILED;
+
+    bool found = count > 0;
+    if (found)
+    {
+        job->tops[shard] = std::move(top);
+        job->releases[shard] = std::move(releases);
+        job->counts[shard] = count;
+    }
+
+    bool last = ++job->finished_shards == job->tops.size();
+
+    // Publish what we have so far, only the best releases are merged. Until
+    // all bots are searched, releases offered by several of them are counted
+    // once per bot, the exact total is only worked out in the end.
+    // Results of cancelled jobs stay as they were.
+    if (found || last)
+    {
+        std::size_t total = last ? count_releases(job->releases, job->counts) : std::accumulate(job->counts.begin(), job->counts.end(), std::size_t(0));
+        job->results = merge(job->request, job->tops, total, job->k);
+    }
+
+    if (last)
+        finish_job(*job, job->request.cacheable);
+}
+
+void xdccd::SearchManager::finish_job(SearchJob &job, bool cache)
+{
+    if (job.state == xdccd::search::RUNNING)
+        job.state = job.is_cancelled() ? xdccd::search::CANCELLED : xdccd::search::FINISHED;
+
+    job.finished = std::chrono::steady_clock::now();
+
+    // Only complete results are worth reusing
+    if (job.state == xdccd::search::FINISHED && cache)
+    {
+        if (job.results->total == 0 && is_negative_cacheable(job.request))
+            insert_negative(job.request);
+        else
+            insert(job.request.key, job.request.versions, job.results);
+    }
+
+    // The results of every bot are merged already
+    job.tops.clear();
+    job.releases.clear();
+    job.counts.clear();
+
+    // Not under jobs_lock, which is only ever taken before the lock of a job
+    running_jobs--;
+}
+
+void xdccd::SearchManager::prune_jobs()
+{
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto it = jobs.begin(); it != jobs.end(); )
+    {
+        bool expired;
+
+        {
+            std::lock_guard<std::mutex> lock(it->second->lock);
+
+            // Ordered by ID, so the oldest jobs go first when there are too many
+            expired = it->second->state != xdccd::search::RUNNING && (now - it->second->finished > xdccd::search::JOB_LIFETIME || jobs.size() > xdccd::search::MAX_JOBS);
+        }
+
+        if (expired)
+            it = jobs.erase(it);
+        else
+            ++it;
+    }
+}
+
+std::vector<std::string> xdccd::SearchManager::normalize(const std::string &query)
+{
+    std::vector<std::string> terms;
+    boost::algorithm::split(terms, fold_case(query), boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+    terms.erase(std::remove(terms.begin(), terms.end(), ""), terms.end());
+
+    // Neither matching nor scoring depend on the order of terms
+    std::sort(terms.begin(), terms.end());
+
+    return terms;
+}
+
+unsigned int xdccd::SearchManager::get_max_typos(const std::string &term)
+{
+    if (term.size() < xdccd::search::ONE_TYPO_LENGTH)
+        return 0;
+
+    return term.size() < xdccd::search::TWO_TYPOS_LENGTH ? 1 : xdccd::search::MAX_TYPOS;
+}
+
+bool xdccd::SearchManager::is_negative_cacheable(const SearchRequest &request) const
+{
+    return max_cache_memory > 0 && request.cacheable && !request.terms.empty() && request.options.filter.min_downloads == 0;
+}
+
+bool xdccd::SearchManager::lookup_negative(const SearchRequest &request)
+{
+    negative_shards_t shards;
+
+    {
+        std::lock_guard<std::mutex> lock(cache_lock);
+
+        auto it = negatives.find(request.key);
+        if (it == negatives.end())
+            return false;
+
+        shards = it->second.first;
+    }
+
+    // Announces are only looked at outside of the lock, the bots searched
+    // have to be the same, and only have added announces since
+    bool valid = shards.size() == request.snapshots.size();
+    for (std::size_t i = 0; i < shards.size() && valid; ++i)
+    {
+        const AnnounceSnapshot &snapshot = *request.snapshots[i];
+        NegativeShard &shard = shards[i];
+
+        valid = shard.bot == request.versions[i].first && shard.epoch == snapshot.get_epoch() && shard.end <= snapshot.get_end_id()
+            && snapshot.get_end_id() - shard.end <= xdccd::search::MAX_NEGATIVE_RECHECK && !matches_since(snapshot, shard.end, request);
+
+        shard.end = snapshot.get_end_id();
+    }
+
+    std::lock_guard<std::mutex> lock(cache_lock);
+
+    auto it = negatives.find(request.key);
+    if (it == negatives.end())
+        return false;
+
+    if (!valid)
+    {
+        negative_lru.erase(it->second.second);
+        negatives.erase(it);
+        return false;
+    }
+
+    // Announces checked now don't have to be checked again
+    it->second.first = shards;
+    negative_lru.splice(negative_lru.begin(), negative_lru, it->second.second);
+    negative_hits++;
+
+    return true;
+}
+
+void xdccd::SearchManager::insert_negative(const SearchRequest &request)
+{
+    negative_shards_t shards;
+    for (std::size_t i = 0; i < request.snapshots.size(); ++i)
+        shards.push_back(NegativeShard{request.versions[i].first, request.snapshots[i]->get_epoch(), request.snapshots[i]->get_end_id()});
+
     std::lock_guard<std::mutex> lock(cache_lock);
 
-    auto cache_it = cache.find(query);
-    std::chrono::duration<double> age(0);
+    auto it = negatives.find(request.key);
+    if (it != negatives.end())
+    {
+        negative_lru.erase(it->second.second);
+        negatives.erase(it);
+    }
 
-    if (cache_it != cache.end())
+    while (negatives.size() >= xdccd::search::MAX_NEGATIVE_ENTRIES)
     {
-        age = std::chrono::system_clock::now() - cache_it->second->created;
+        negatives.erase(negative_lru.back());
+        negative_lru.pop_back();
+    }
+
+    negative_lru.push_front(request.key);
+    negatives.emplace(request.key, std::make_pair(std::move(shards), negative_lru.begin()));
+}
 
-        // Remove cache entries older than MAX_CACHE_AGE
-        if (age >= xdccd::search::MAX_CACHE_AGE)
+bool xdccd::SearchManager::matches_since(const AnnounceSnapshot &snapshot, announce_id_t begin, const SearchRequest &request) const
+{
+    std::vector<FuzzyPattern> patterns;
+    if (request.options.fuzzy)
+        patterns.assign(request.terms.begin(), request.terms.end());
+
+    // Filters are not applied, announces not passing them only make this
+    // search again
+    std::string buffer;
+    for (announce_id_t id = begin; id < snapshot.get_end_id(); ++id)
+    {
+        if (!snapshot.is_visible(id))
+            continue;
+
+        StringRef filename = snapshot.get_folded_filename(id, buffer);
+        unsigned int fuzzy_score;
+
+        if (request.options.fuzzy)
         {
-            BOOST_LOG_TRIVIAL(debug) << "Removing cached search result for '" << query << "' due to old age.";
-            cache.erase(cache_it);
-            cache_it = cache.end();
+            if (score_fuzzy(filename, request.terms, patterns, fuzzy_score))
+                return true;
         }
+        else if (std::all_of(request.terms.begin(), request.terms.end(), [filename](const std::string &term) { return contains_folded(filename.data, filename.length, term); }))
+            return true;
     }
 
-    SearchResultPtr sr = std::make_shared<SearchResult>(0, start);
+    return false;
+}
+
+xdccd::ResultSetPtr xdccd::SearchManager::lookup(const std::string &key, const versions_t &versions, std::size_t needed)
+{
+    std::lock_guard<std::mutex> lock(cache_lock);
 
-    if (cache_it == cache.end())
+    auto it = cache.find(key);
+    if (it == cache.end())
     {
-        std::vector<xdccd::SearchResultItemPtr> tmp;
+        misses++;
+        return nullptr;
+    }
 
-        // Split the query up
-        std::vector<std::string> split_query;
-        boost::algorithm::split(split_query, query, boost::algorithm::is_space(), boost::algorithm::token_compress_on );
+    if (it->second->versions != versions)
+    {
+        BOOST_LOG_TRIVIAL(debug) << "Cached search result for '" << key << "' is outdated.";
+        erase(it->second);
+        invalidations++;
+        misses++;
+        return nullptr;
+    }
 
-        for (auto bot : manager.get_bots())
-            search_in_announces(bot->get_announces(), split_query, tmp);
+    // Asked for a page beyond the results we kept, the entry is replaced
+    ResultSetPtr results = it->second->results;
+    if (results->items.size() < needed && !results->is_complete())
+    {
+        misses++;
+        return nullptr;
+    }
 
-        // Do not cache empty search results
-        if (tmp.empty())
-            return sr;
+    lru.splice(lru.begin(), lru, it->second);
+    hits++;
 
-        std::sort(tmp.begin(), tmp.end(), [](SearchResultItemPtr& x, SearchResultItemPtr& y) { return x->score > y->score; });
+    return results;
+}
+
+void xdccd::SearchManager::insert(const std::string &key, const versions_t &versions, ResultSetPtr results)
+{
+    std::size_t memory = sizeof(CacheEntry) + key.capacity() + versions.capacity() * sizeof(versions_t::value_type) + results->get_memory_usage();
+
+    // Would push out everything else
+    if (memory > max_cache_memory / 2)
+        return;
+
+    std::lock_guard<std::mutex> lock(cache_lock);
 
-        BOOST_LOG_TRIVIAL(debug) << "Cached search result for '" << query << "' with " << tmp.size() << " results.";
+    // Another request might have searched for the same query in the meantime
+    auto it = cache.find(key);
+    if (it != cache.end())
+        erase(it->second);
 
-        // Insert newly generated CacheEntry
-        auto insert_result = cache.insert(std::make_pair(query, std::make_unique<CacheEntry>(query, std::move(tmp))));
-        cache_it = insert_result.first;
+    while (cache_memory + memory > max_cache_memory && !lru.empty())
+    {
+        erase(std::prev(lru.end()));
+        evictions++;
     }
 
-    sr->total_results = cache_it->second->results.size();
+    lru.push_front(CacheEntry{key, versions, results, memory});
+    cache[key] = lru.begin();
+    cache_memory += memory;
+
+    BOOST_LOG_TRIVIAL(debug) << "Cached search result for '" << key << "' with " << results->items.size() << " results.";
+}
+
+void xdccd::SearchManager::erase(lru_list_t::iterator entry)
+{
+    cache_memory -= entry->memory;
+    cache.erase(entry->key);
+    lru.erase(entry);
+}
+
+void xdccd::SearchManager::for_each_shard(std::size_t shards, const std::function<void (std::size_t)> &work)
+{
+    if (shards == 0)
+        return;
 
-    if (start >= sr->total_results)
-        return sr;
+    std::vector<std::future<void>> pending;
 
-    std::size_t end = std::min(sr->total_results - start, static_cast<std::size_t>(limit));
-    sr->begin = cache_it->second->results.begin() + start;
-    sr->end = cache_it->second->results.begin() + start + end;
+    for (std::size_t shard = 1; shard < shards; ++shard)
+    {
+        auto task = std::make_shared<std::packaged_task<void ()>>([&work, shard]() { work(shard); });
+        pending.push_back(task->get_future());
+        workers.post([task]() { (*task)(); });
+    }
 
-    return sr;
+    // The calling thread takes a share as well
+    std::exception_ptr error;
+    try
+    {
+        work(0);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    // Tasks reference work, so all of them have to finish before we return
+    for (auto &result : pending)
+    {
+        try
+        {
+            result.get();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+
+    if (error)
+        std::rethrow_exception(error);
 }
 
-void xdccd::SearchManager::search_in_announces(const std::map<std::string, xdccd::DCCAnnouncePtr> &announces, const std::vector<std::string> &query, std::vector<xdccd::SearchResultItemPtr> &results) const
+std::size_t xdccd::SearchManager::search_in_announces(std::uint32_t shard, const xdccd::AnnounceSnapshot &announces, const std::vector<std::string> &query, const SearchOptions &options, std::size_t k, std::vector<xdccd::SearchResultItem> &top, std::vector<release_t> *releases) const
 {
-    // Iterate all announces
-    for (auto announce : announces)
+    std::size_t count = 0;
+
+    if (releases)
+        releases->clear();
+
+    top.clear();
+
+    // A term no announce can contain rules out the bot before any other work.
+    // Terms with typos can match anything.
+    if (!options.fuzzy && std::any_of(query.begin(), query.end(), [&announces](const std::string &term) { return !announces.may_contain(term); }))
+        return 0;
+
+    // Filters are cheaper than looking at filenames, so they go first.
+    // Without a query, every announce passing them is a candidate.
+    AnnounceBitmap allowed;
+    const AnnounceBitmap *restriction = nullptr;
+    if (query.empty() || !options.filter.is_empty())
     {
-        // Split & iterate the filename by '.'
-        auto start_it = boost::algorithm::make_split_iterator(announce.second->filename, boost::algorithm::first_finder(".", boost::algorithm::is_equal()));
-        auto end = boost::split_iterator<std::string::iterator>();
+        announces.filter(options.filter, allowed);
+        restriction = &allowed;
+    }
+
+    std::vector<announce_id_t> candidates, postings, tmp;
+    if (query.empty())
+        allowed.get_ids(candidates);
+    else
+        find_candidates(announces, query[0], options, restriction, candidates);
 
-        unsigned int score = 0;
-        // Check if our query contains the current filename part
-        for (auto qit = query.begin(); qit != query.end(); ++qit)
+    // Only announces containing every term of the query are candidates
+    for (std::size_t i = 1; i < query.size() && !candidates.empty(); ++i)
+    {
+        find_candidates(announces, query[i], options, restriction, postings);
+        intersect(candidates, postings, tmp);
+        candidates.swap(tmp);
+    }
+
+    // Group the copies of each release
+    std::vector<copy_t> copies;
+    copies.reserve(candidates.size());
+    for (announce_id_t id : candidates)
+        copies.emplace_back(announces.get_release(id), id);
+
+    std::sort(copies.begin(), copies.end());
+
+    std::vector<FuzzyPattern> patterns;
+    if (options.fuzzy)
+        patterns.assign(query.begin(), query.end());
+
+    // Heap with the worst of the best k results at the front, copies share
+    // their release's score, so only the first one is scored
+    std::string buffer;
+    for (std::size_t first = 0, last; first < copies.size(); first = last)
+    {
+        release_t release = copies[first].first;
+
+        for (last = first + 1; last < copies.size() && copies[last].first == release; ++last)
+            ;
+
+        unsigned int release_score = 0;
+
+        // Fuzzy candidates might not match at all
+        if (options.fuzzy)
         {
-            for(auto it = start_it; it != end; ++it)
+            if (!score_fuzzy(announces.get_folded_filename(copies[first].second, buffer), query, patterns, release_score))
+                continue;
+        }
+        else if (k > 0)
+            release_score = score(announces.get_folded_filename(copies[first].second, buffer), query);
+
+        // Copies are sorted, so releases are as well
+        count++;
+        if (releases)
+            releases->push_back(release);
+
+        if (k == 0)
+            continue;
+
+        SearchResultItem item(release, release_score);
+
+        if (top.size() < k)
+        {
+            top.push_back(std::move(item));
+            std::push_heap(top.begin(), top.end(), ranks_before);
+        }
+        else if (ranks_before(item, top.front()))
+        {
+            std::pop_heap(top.begin(), top.end(), ranks_before);
+            top.back() = std::move(item);
+            std::push_heap(top.begin(), top.end(), ranks_before);
+        }
+    }
+
+    // Only the releases that made it get their sources
+    for (auto &item : top)
+    {
+        auto range = std::equal_range(copies.begin(), copies.end(), copy_t(item.release, 0), [](const copy_t &x, const copy_t &y) { return x.first < y.first; });
+
+        item.sources.reserve(range.second - range.first);
+        for (auto it = range.first; it != range.second; ++it)
+            item.sources.push_back(ReleaseSource{shard, it->second});
+    }
+
+    return count;
+}
+
+void xdccd::SearchManager::find_candidates(const xdccd::AnnounceSnapshot &announces, const std::string &term, const SearchOptions &options, const AnnounceBitmap *allowed, std::vector<announce_id_t> &result) const
+{
+    unsigned int typos = options.fuzzy ? get_max_typos(term) : 0;
+
+    if (typos == 0)
+    {
+        announces.find(term, result, allowed);
+        return;
+    }
+
+    // Every typo changes at most one of typos + 1 pieces of the term, so
+    // matches contain at least one of them unchanged. Only swapped characters
+    // can span two pieces, so the pieces of the term with the characters
+    // around the borders swapped are looked for as well.
+    std::size_t piece_length = term.size() / (typos + 1);
+    std::set<std::string> pieces;
+
+    for (unsigned int swapped = 0; swapped < (1u << typos); ++swapped)
+    {
+        std::string variant = term;
+        for (unsigned int i = 0; i < typos; ++i)
+        {
+            std::size_t border = (i + 1) * piece_length;
+            if (swapped & (1u << i))
+                std::swap(variant[border - 1], variant[border]);
+        }
+
+        for (unsigned int i = 0; i <= typos; ++i)
+            pieces.insert(variant.substr(i * piece_length, i == typos ? std::string::npos : piece_length));
+    }
+
+    std::vector<announce_id_t> postings, merged;
+
+    result.clear();
+    for (auto &piece : pieces)
+    {
+        announces.find(piece, postings, allowed);
+
+        merged.clear();
+        std::set_union(result.begin(), result.end(), postings.begin(), postings.end(), std::back_inserter(merged));
+        result.swap(merged);
+    }
+}
+
+unsigned int xdccd::SearchManager::score(xdccd::StringRef filename, const std::vector<std::string> &query) const
+{
+    const char *end = filename.data + filename.length;
+
+    unsigned int score = 0;
+    // Every term scores for the first part (split by '.') containing it, exact matches score twice
+    for (auto qit = query.begin(); qit != query.end(); ++qit)
+    {
+        for (const char *part = filename.data; ; )
+        {
+            const char *part_end = std::find(part, end, '.');
+            std::size_t length = part_end - part;
+
+            if (contains_folded(part, length, *qit))
+            {
+                score += 1 + ((*qit).size() == length);
+                break;
+            }
+
+            if (part_end == end)
+                break;
+
+            part = part_end + 1;
+        }
+    }
+
+    return score;
+}
+
+bool xdccd::SearchManager::score_fuzzy(xdccd::StringRef filename, const std::vector<std::string> &query, const std::vector<FuzzyPattern> &patterns, unsigned int &score) const
+{
+    const char *end = filename.data + filename.length;
+
+    score = 0;
+    // Like score(), but every term scores for the part closest to it, less
+    // for every typo. Parts made up of the term alone (typos aside) score once more.
+    for (std::size_t i = 0; i < query.size(); ++i)
+    {
+        std::size_t term_length = query[i].size();
+        unsigned int typos = get_max_typos(query[i]);
+        unsigned int best = typos + 1;
+        bool covered = false;
+
+        for (const char *part = filename.data; ; )
+        {
+            const char *part_end = std::find(part, end, '.');
+            std::size_t length = part_end - part;
+
+            unsigned int distance = patterns[i].distance(part, length);
+            bool part_covered = length <= term_length + distance && term_length <= length + distance;
+
+            if (distance < best || (distance == best && part_covered))
             {
-                if (boost::algorithm::icontains(*it, *qit))
-                {
-                    score += 1 + ((*qit).size() == (*it).size());
-                    break;
-                }
+                best = distance;
+                covered = part_covered;
             }
+
+            if (part_end == end || (best == 0 && covered))
+                break;
+
+            part = part_end + 1;
         }
 
-        // Do not add results with score == 0
-        if (score >= query.size())
-            results.push_back(std::make_unique<SearchResultItem>(announce.second, score));
+        if (best > typos)
+            return false;
+
+        score += (xdccd::search::MAX_TYPOS + 1 - best) * 2 + covered;
     }
+
+    return true;
 }
 
 void xdccd::SearchManager::clear()
 {
     BOOST_LOG_TRIVIAL(debug) << "Clearing SearchManager!";
+
+    std::lock_guard<std::mutex> lock(cache_lock);
     cache.clear();
+    lru.clear();
+    cache_memory = 0;
+
+    negatives.clear();
+    negative_lru.clear();
+}
+
+xdccd::SearchCacheStats xdccd::SearchManager::get_stats()
+{
+    std::lock_guard<std::mutex> lock(cache_lock);
+    return SearchCacheStats{lru.size(), cache_memory, hits, misses, invalidations, evictions, negatives.size(), negative_hits};
 }
@@ -1,63 +1,356 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <string>
 #include <vector>
+#include <list>
 #include <map>
-#include <chrono>
+#include <unordered_map>
+#include <mutex>
 
 #include "dccbot.h"
 #include "botmanager.h"
+#include "workerpool.h"
+#include "stringmatch.h"
 
 namespace xdccd
 {
 
 namespace search
 {
-static const std::chrono::duration<double> MAX_CACHE_AGE(5 * 60);
 static const std::size_t RESULTS_PER_PAGE(25);
+
+// Upper bound for the memory used by cached search results
+static const std::size_t MAX_CACHE_MEMORY(32 * 1024 * 1024);
+
+// Number of best results kept for a query at least, so the first pages can
+// be served from the cache
+static const std::size_t CACHED_RESULTS(100);
+
+// Queries without results are remembered on their own, up to this many.
+// They are not searched again as long as none of the announces added since
+// matches them, which is checked for up to MAX_NEGATIVE_RECHECK of those per
+// bot.
+static const std::size_t MAX_NEGATIVE_ENTRIES(4096);
+static const std::size_t MAX_NEGATIVE_RECHECK(4096);
+
+// Bots are searched in parallel by up to this many threads
+static const std::size_t MAX_WORKER_THREADS(8);
+
+// Fuzzy searches allow up to one typo in terms of this length, two in longer
+// ones, none in shorter ones
+static const std::size_t ONE_TYPO_LENGTH(4);
+static const std::size_t TWO_TYPOS_LENGTH(8);
+static const unsigned int MAX_TYPOS(2);
+
+// Search jobs running at once, more are turned away
+static const std::size_t MAX_RUNNING_JOBS(4);
+
+// Finished jobs are kept this long for their results to be fetched, but
+// only up to MAX_JOBS of them
+static const std::chrono::minutes JOB_LIFETIME(5);
+static const std::size_t MAX_JOBS(64);
+
+enum JobState
+{
+    RUNNING,
+    FINISHED,
+    CANCELLED,
+    FAILED
+};
+
+const char *job_state_name(JobState state);
 }
 
+typedef std::uint64_t search_job_id_t;
+
+struct SearchOptions
+{
+    SearchOptions();
+
+    // Also match terms with typos, ranked below exact matches
+    bool fuzzy;
+
+    // Only announces passing filter are searched, all of them if the query
+    // is empty
+    AnnounceFilter filter;
+
+    // Hosts of the bots to search, empty for all
+    std::vector<std::string> networks;
+
+    bool is_filtered() const;
+};
+
+// An announce offering a release
+struct ReleaseSource
+{
+    // Index of the snapshot in ResultSet::snapshots
+    std::uint32_t shard;
+    announce_id_t id;
+};
+
+// A release matching a query, along with every announce offering it
 struct SearchResultItem
 {
-    SearchResultItem(DCCAnnouncePtr announce, unsigned int score);
+    SearchResultItem(release_t release, unsigned int score);
 
-    DCCAnnouncePtr announce;
+    release_t release;
     unsigned int score;
+
+    // Sorted by shard and ID
+    std::vector<ReleaseSource> sources;
 };
 
-typedef std::unique_ptr<SearchResultItem> SearchResultItemPtr;
+// The best results of a query, sorted by score. Never modified once created,
+// so it can be shared between the cache and any number of result pages.
+struct ResultSet
+{
+    ResultSet();
+
+    // Snapshots of the announces of every searched bot
+    std::vector<AnnounceSnapshotPtr> snapshots;
+    std::vector<SearchResultItem> items;
+
+    // Number of matching releases, items only holds the best of them
+    std::size_t total;
 
+    // The first announce offering the release of item
+    DCCAnnouncePtr get(const SearchResultItem &item) const;
+    DCCAnnouncePtr get(const ReleaseSource &source) const;
+    bool is_complete() const;
+    std::size_t get_memory_usage() const;
+};
+
+typedef std::shared_ptr<const ResultSet> ResultSetPtr;
+
+// A page of a ResultSet
 struct SearchResult
 {
-    SearchResult(std::size_t total_results, std::size_t result_start);
+    SearchResult(ResultSetPtr results, std::size_t result_start, std::size_t limit);
     std::size_t total_results;
     std::size_t result_start;
-    std::vector<SearchResultItemPtr>::const_iterator begin;
-    std::vector<SearchResultItemPtr>::const_iterator end;
+    ResultSetPtr results;
+    std::vector<SearchResultItem>::const_iterator begin;
+    std::vector<SearchResultItem>::const_iterator end;
 };
 
 typedef std::shared_ptr<SearchResult> SearchResultPtr;
 
-struct CacheEntry
+// A query, prepared for the bots it runs on
+struct SearchRequest
 {
-    CacheEntry(const std::string &query, std::vector<SearchResultItemPtr> results);
-    std::string query;
-    std::vector<SearchResultItemPtr> results;
-    std::chrono::time_point<std::chrono::system_clock> created;
+    std::vector<std::string> terms;
+    SearchOptions options;
+
+    // Equal for requests with the same results
+    std::string key;
+
+    // Version of every searched bot's announces, results are computed from
+    // and validated against exactly these
+    std::vector<AnnounceSnapshotPtr> snapshots;
+    std::vector<std::pair<bot_id_t, generation_t>> versions;
+
+    // Announces age without a new snapshot, so searches depending on the
+    // current time are never reused
+    bool cacheable;
+
+    bool is_empty() const;
+};
+
+// A search running in the background. Every bot is searched on its own,
+// the results of those searched so far are available while the others are
+// still running.
+class SearchJob
+{
+    public:
+        SearchJob(search_job_id_t id, std::size_t k);
+
+        SearchJob(const SearchJob&) = delete;
+        SearchJob &operator=(const SearchJob&) = delete;
+
+        search_job_id_t get_id() const;
+        search::JobState get_state() const;
+
+        // Number of bots searched so far, and overall
+        std::size_t get_finished_shards() const;
+        std::size_t get_shards() const;
+
+        // The best results found so far, all of them once finished
+        ResultSetPtr get_results() const;
+
+        // Bots not searched yet are skipped, results found so far are kept
+        void cancel();
+        bool is_cancelled() const;
+
+    private:
+        friend class SearchManager;
+
+        search_job_id_t id;
+        SearchRequest request;
+
+        // Number of best results kept
+        std::size_t k;
+
+        mutable std::mutex lock;
+        search::JobState state;
+        std::size_t finished_shards;
+        std::chrono::steady_clock::time_point finished;
+
+        // Results of every bot, empty until it has been searched
+        std::vector<std::vector<SearchResultItem>> tops;
+        std::vector<std::vector<release_t>> releases;
+        std::vector<std::size_t> counts;
+        ResultSetPtr results;
+
+        std::atomic<bool> cancelled;
 };
 
-typedef std::unique_ptr<CacheEntry> CacheEntryPtr;
+typedef std::shared_ptr<SearchJob> SearchJobPtr;
+
+struct SearchCacheStats
+{
+    std::size_t entries;
+    std::size_t memory;
+    std::size_t hits;
+    std::size_t misses;
+    std::size_t invalidations;
+    std::size_t evictions;
+    std::size_t negative_entries;
+    std::size_t negative_hits;
+};
 
 class SearchManager
 {
     public:
-        SearchResultPtr search(BotManager &manager, const std::string &query, std::size_t start = 0, std::size_t limit = 25);
+        SearchManager(std::size_t max_cache_memory = search::MAX_CACHE_MEMORY);
+
+        SearchResultPtr search(BotManager &manager, const std::string &query, std::size_t start = 0, std::size_t limit = 25, const SearchOptions &options = SearchOptions());
+        SearchResultPtr search(const std::vector<DCCBotPtr> &bots, const std::string &query, std::size_t start = 0, std::size_t limit = 25, const SearchOptions &options = SearchOptions());
+
+        // Starts searching for (at least) the best limit results in the
+        // background. Returns nullptr if too many searches are running.
+        SearchJobPtr submit(BotManager &manager, const std::string &query, std::size_t limit = 25, const SearchOptions &options = SearchOptions());
+        SearchJobPtr submit(const std::vector<DCCBotPtr> &bots, const std::string &query, std::size_t limit = 25, const SearchOptions &options = SearchOptions());
+
+        // nullptr if there is no such job (anymore)
+        SearchJobPtr get_job(search_job_id_t id);
+        std::size_t get_running_jobs();
+
         void clear();
 
+        SearchCacheStats get_stats();
+
+        // Lowercased terms of query, sorted, so equivalent queries share a cache entry
+        static std::vector<std::string> normalize(const std::string &query);
+
+        static unsigned int get_max_typos(const std::string &term);
+
     private:
-        void search_in_announces(const std::map<std::string, xdccd::DCCAnnouncePtr> &announces, const std::vector<std::string> &query, std::vector<SearchResultItemPtr> &results) const;
+        // Cached results stay valid as long as the snapshots of the searched
+        // bots are the same (bot, generation) as when they were created
+        typedef std::vector<std::pair<bot_id_t, generation_t>> versions_t;
+
+        void prepare(const std::vector<DCCBotPtr> &bots, const std::string &query, const SearchOptions &options, SearchRequest &request) const;
+
+        // Number of best results to keep if needed are asked for
+        static std::size_t get_kept_results(std::size_t needed);
+
+        // Joins the best k releases of every bot
+        static ResultSetPtr merge(const SearchRequest &request, const std::vector<std::vector<SearchResultItem>> &tops, std::size_t total, std::size_t k);
+
+        // Number of distinct releases found, given the number found in every
+        // bot and, if there are several, the releases themselves
+        static std::size_t count_releases(const std::vector<std::vector<release_t>> &releases, const std::vector<std::size_t> &counts);
+
+        // Searches a single bot for job, and publishes the results so far
+        void run_shard(SearchJobPtr job, std::size_t shard);
+        void finish_job(SearchJob &job, bool cache);
+
+        // Forgets old finished jobs, jobs_lock has to be held
+        void prune_jobs();
+
+        struct CacheEntry
+        {
+            std::string key;
+            versions_t versions;
+            ResultSetPtr results;
+            std::size_t memory;
+        };
+
+        typedef std::list<CacheEntry> lru_list_t;
+
+        // A query without results in the announces of bot below end, which
+        // stays true for as long as its epoch does
+        struct NegativeShard
+        {
+            bot_id_t bot;
+            generation_t epoch;
+            announce_id_t end;
+        };
+
+        typedef std::vector<NegativeShard> negative_shards_t;
+        typedef std::list<std::string> negative_lru_t;
+
+        // Download counts grow, so queries filtering on them might match
+        // announces later on that they don't match now
+        bool is_negative_cacheable(const SearchRequest &request) const;
+
+        // Returns true if request is known to have no results
+        bool lookup_negative(const SearchRequest &request);
+        void insert_negative(const SearchRequest &request);
+
+        // Whether an announce of snapshot with ID begin or higher matches request
+        bool matches_since(const AnnounceSnapshot &snapshot, announce_id_t begin, const SearchRequest &request) const;
+
+        // Returns a cached result set holding at least the best needed results
+        ResultSetPtr lookup(const std::string &key, const versions_t &versions, std::size_t needed);
+        void insert(const std::string &key, const versions_t &versions, ResultSetPtr results);
+        void erase(lru_list_t::iterator entry);
+
+        // Runs work(shard) for every shard, in parallel on the worker pool
+        void for_each_shard(std::size_t shards, const std::function<void (std::size_t)> &work);
+
+        // Collects the best k releases of a bot into top and returns the
+        // number of matching releases. These are collected, sorted, into
+        // releases unless it is null, which is only needed to tell releases
+        // offered by several bots apart.
+        std::size_t search_in_announces(std::uint32_t shard, const AnnounceSnapshot &announces, const std::vector<std::string> &query, const SearchOptions &options, std::size_t k, std::vector<SearchResultItem> &top, std::vector<release_t> *releases) const;
+
+        // Announces possibly containing term, fuzzy ones have to be verified
+        void find_candidates(const AnnounceSnapshot &announces, const std::string &term, const SearchOptions &options, const AnnounceBitmap *allowed, std::vector<announce_id_t> &result) const;
+
+        // Filenames are folded, like the terms of the query
+        unsigned int score(StringRef filename, const std::vector<std::string> &query) const;
+
+        // Returns false if a term does not match filename with the typos allowed
+        bool score_fuzzy(StringRef filename, const std::vector<std::string> &query, const std::vector<FuzzyPattern> &patterns, unsigned int &score) const;
+
         std::mutex cache_lock;
-        std::map<std::string, CacheEntryPtr> cache;
+
+        // Most recently used entries first
+        lru_list_t lru;
+        std::unordered_map<std::string, lru_list_t::iterator> cache;
+        std::size_t max_cache_memory;
+        std::size_t cache_memory;
+
+        std::size_t hits;
+        std::size_t misses;
+        std::size_t invalidations;
+        std::size_t evictions;
+
+        // Also guarded by cache_lock, most recently used first
+        negative_lru_t negative_lru;
+        std::unordered_map<std::string, std::pair<negative_shards_t, negative_lru_t::iterator>> negatives;
+        std::size_t negative_hits;
+
+        std::mutex jobs_lock;
+        std::map<search_job_id_t, SearchJobPtr> jobs;
+        search_job_id_t last_job_id;
+        std::atomic<std::size_t> running_jobs;
+
+        // Last member, so workers are stopped before anything they use is gone
+        WorkerPool workers;
 };
 
 }
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <functional>
+#include <chrono>
 #include <boost/bind.hpp>
 
 #include "socket.h"
@@ -47,8 +48,8 @@ bool xdccd::PlainSocket::is_open() const
 
 /* SSL Socket */
 
-xdccd::SSLSocket::SSLSocket(boost::asio::io_service &io_service)
-    : ssl_context(boost::asio::ssl::context::sslv23), socket(io_service, ssl_context)
+xdccd::SSLSocket::SSLSocket(boost::asio::io_service &io_service, SSLContextPtr ssl_context)
+    : ssl_context(ssl_context), socket(io_service, ssl_context->get())
 {
     socket.set_verify_mode(boost::asio::ssl::verify_peer);
     socket.set_verify_callback(boost::bind(&SSLSocket::verify_certificate, this, _1, _2));
@@ -57,7 +58,18 @@ xdccd::SSLSocket::SSLSocket(boost::asio::io_service &io_service)
 void xdccd::SSLSocket::connect(const boost::asio::ip::tcp::endpoint& endpoint, boost::system::error_code& error)
 {
     socket.lowest_layer().connect(endpoint, error);
-    socket.handshake(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>::client);
+
+    if (error)
+        return;
+
+    // Try to resume a previous session of this network
+    ssl_context->prepare(socket.native_handle());
+
+    auto start = std::chrono::steady_clock::now();
+    socket.handshake(boost::asio::ssl::stream<boost::asio::ip::tcp::socket>::client, error);
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    ssl_context->on_handshake(socket.native_handle(), error, duration);
 }
 
 void xdccd::SSLSocket::close()
@@ -3,6 +3,8 @@
 #include <boost/asio/ssl.hpp>
 #include <boost/log/trivial.hpp>
 
+#include "sslcontext.h"
+
 namespace xdccd
 {
 class Socket
@@ -37,7 +39,7 @@ class PlainSocket : public Socket
 class SSLSocket : public Socket
 {
     public:
-        SSLSocket(boost::asio::io_service &io_service);
+        SSLSocket(boost::asio::io_service &io_service, SSLContextPtr ssl_context);
         virtual void connect(const boost::asio::ip::tcp::endpoint& endpoint, boost::system::error_code& error);
         virtual void close();
         virtual void cancel();
@@ -49,7 +51,7 @@ class SSLSocket : public Socket
     private:
         bool verify_certificate(bool preverified, boost::asio::ssl::verify_context& ctx);
 
-        boost::asio::ssl::context ssl_context;
+        SSLContextPtr ssl_context;
         boost::asio::ssl::stream<boost::asio::ip::tcp::socket> socket;
 };
 }
@@ -0,0 +1,148 @@
+#include <boost/log/trivial.hpp>
+
+#include "sslcontext.h"
+
+xdccd::TLSStats::TLSStats()
+    : handshakes(0), resumed(0), failed(0), handshake_time_us(0)
+{}
+
+xdccd::SSLContext::SSLContext(const std::string &host, const std::string &port)
+    : host(host), port(port), context(boost::asio::ssl::context::sslv23)
+{
+    SSL_CTX *ctx = context.native_handle();
+
+    // Sessions are stored by us (per network), not in OpenSSL's internal cache
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, &SSLContext::on_new_session);
+    SSL_CTX_set_app_data(ctx, this);
+}
+
+xdccd::SSLContext::~SSLContext()
+{
+    std::lock_guard<std::mutex> lock(sessions_lock);
+    for (SSL_SESSION *session : sessions)
+        SSL_SESSION_free(session);
+}
+
+boost::asio::ssl::context &xdccd::SSLContext::get()
+{
+    return context;
+}
+
+const std::string &xdccd::SSLContext::get_host() const
+{
+    return host;
+}
+
+const std::string &xdccd::SSLContext::get_port() const
+{
+    return port;
+}
+
+const xdccd::TLSStats &xdccd::SSLContext::get_stats() const
+{
+    return stats;
+}
+
+std::size_t xdccd::SSLContext::get_cached_sessions()
+{
+    std::lock_guard<std::mutex> lock(sessions_lock);
+    return sessions.size();
+}
+
+void xdccd::SSLContext::prepare(SSL *ssl)
+{
+    // Session tickets are bound to the server name, IP literals must not be sent as SNI
+    boost::system::error_code error;
+    boost::asio::ip::make_address(host, error);
+    if (error)
+        SSL_set_tlsext_host_name(ssl, host.c_str());
+
+    std::lock_guard<std::mutex> lock(sessions_lock);
+
+    // Newest sessions are at the front, drop the ones that expired in the meantime
+    while (!sessions.empty() && !SSL_SESSION_is_resumable(sessions.front()))
+    {
+        SSL_SESSION_free(sessions.front());
+        sessions.pop_front();
+    }
+
+    if (sessions.empty())
+        return;
+
+    SSL_SESSION *session = sessions.front();
+    SSL_set_session(ssl, session);
+
+    // TLS 1.3 tickets should only be used once, older sessions can be shared
+    if (SSL_SESSION_get_protocol_version(session) >= TLS1_3_VERSION)
+    {
+        sessions.pop_front();
+        SSL_SESSION_free(session);
+    }
+}
+
+void xdccd::SSLContext::on_handshake(SSL *ssl, const boost::system::error_code &error, std::chrono::microseconds duration)
+{
+    if (error)
+    {
+        stats.failed++;
+        return;
+    }
+
+    bool reused = SSL_session_reused(ssl);
+
+    stats.handshakes++;
+    stats.handshake_time_us += duration.count();
+    if (reused)
+        stats.resumed++;
+
+    BOOST_LOG_TRIVIAL(debug) << "TLS handshake with " << host << ":" << port << " took " << duration.count() << "us"
+        << (reused ? " (resumed session)" : "");
+}
+
+int xdccd::SSLContext::on_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    SSLContext *self = static_cast<SSLContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+
+    if (!self)
+        return 0;
+
+    self->add_session(session);
+
+    // We keep the reference OpenSSL handed us
+    return 1;
+}
+
+void xdccd::SSLContext::add_session(SSL_SESSION *session)
+{
+    std::lock_guard<std::mutex> lock(sessions_lock);
+    sessions.push_front(session);
+
+    while (sessions.size() > xdccd::tls::MAX_CACHED_SESSIONS)
+    {
+        SSL_SESSION_free(sessions.back());
+        sessions.pop_back();
+    }
+}
+
+xdccd::SSLContextPtr xdccd::SSLContextManager::get_context(const std::string &host, const std::string &port)
+{
+    std::lock_guard<std::mutex> lock(contexts_lock);
+
+    SSLContextPtr &context = contexts[host + ":" + port];
+    if (!context)
+        context = std::make_shared<SSLContext>(host, port);
+
+    return context;
+}
+
+std::vector<xdccd::SSLContextPtr> xdccd::SSLContextManager::get_contexts()
+{
+    std::lock_guard<std::mutex> lock(contexts_lock);
+
+    std::vector<SSLContextPtr> result;
+    for (auto &context : contexts)
+        result.push_back(context.second);
+
+    return result;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <boost/asio/ssl.hpp>
+
+namespace xdccd
+{
+
+namespace tls
+{
+// Number of session tickets kept per network
+static const std::size_t MAX_CACHED_SESSIONS(8);
+}
+
+struct TLSStats
+{
+    TLSStats();
+
+    std::atomic<std::size_t> handshakes;
+    std::atomic<std::size_t> resumed;
+    std::atomic<std::size_t> failed;
+    std::atomic<std::size_t> handshake_time_us;
+};
+
+// One SSL context per network (host:port), shared by every connection to it.
+// Keeps a client side session cache, so reconnects can resume their
+// TLS session (session IDs/tickets for TLS <= 1.2, PSK for TLS 1.3) instead
+// of doing a full handshake.
+class SSLContext
+{
+    public:
+        SSLContext(const std::string &host, const std::string &port);
+        ~SSLContext();
+
+        boost::asio::ssl::context &get();
+        const std::string &get_host() const;
+        const std::string &get_port() const;
+        const TLSStats &get_stats() const;
+        std::size_t get_cached_sessions();
+
+        // Prepares a new connection: sets SNI and a cached session, if any
+        void prepare(SSL *ssl);
+        void on_handshake(SSL *ssl, const boost::system::error_code &error, std::chrono::microseconds duration);
+
+    private:
+        static int on_new_session(SSL *ssl, SSL_SESSION *session);
+        void add_session(SSL_SESSION *session);
+
+        std::string host;
+        std::string port;
+        boost::asio::ssl::context context;
+        TLSStats stats;
+
+        std::deque<SSL_SESSION*> sessions;
+        std::mutex sessions_lock;
+};
+
+typedef std::shared_ptr<SSLContext> SSLContextPtr;
+
+class SSLContextManager
+{
+    public:
+        SSLContextPtr get_context(const std::string &host, const std::string &port);
+        std::vector<SSLContextPtr> get_contexts();
+
+    private:
+        std::map<std::string, SSLContextPtr> contexts;
+        std::mutex contexts_lock;
+};
+
+}
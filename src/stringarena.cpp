@@ -0,0 +1,152 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "stringarena.h"
+
+std::string xdccd::StringRef::str() const
+{
+    return std::string(data, length);
+}
+
+bool xdccd::StringRef::operator==(const std::string &other) const
+{
+    return other.size() == length && std::memcmp(other.data(), data, length) == 0;
+}
+
+xdccd::StringArena::View::View()
+    : block_size(xdccd::arena::BLOCK_SIZE)
+{}
+
+xdccd::StringArena::View::View(std::shared_ptr<const directory_t> blocks, std::size_t block_size)
+    : blocks(blocks), block_size(block_size)
+{}
+
+xdccd::StringRef xdccd::StringArena::View::get(string_id_t id, std::size_t length) const
+{
+    return StringRef{data(id), length};
+}
+
+const char *xdccd::StringArena::View::data(string_id_t id) const
+{
+    return (*blocks)[id / block_size]->data() + id % block_size;
+}
+
+xdccd::StringArena::StringArena(std::size_t block_size, std::size_t capacity)
+    : blocks(std::make_shared<directory_t>()), block_size(block_size), capacity(capacity), used(block_size)
+{}
+
+xdccd::string_id_t xdccd::StringArena::add(const char *data, std::size_t length)
+{
+    if (length > block_size)
+        throw std::length_error("String too long for arena");
+
+    // Strings never span two blocks, and even empty ones need a block to
+    // point into
+    if (used + length > block_size || used == block_size)
+    {
+        if ((blocks->size() + 1) * block_size > capacity)
+            throw std::length_error("String arena is full");
+
+        // Views might still be reading the old list of blocks
+        auto grown = std::make_shared<directory_t>(*blocks);
+        grown->push_back(std::make_shared<block_t>(block_size));
+        blocks = grown;
+        used = 0;
+    }
+
+    std::memcpy(blocks->back()->data() + used, data, length);
+
+    string_id_t id = static_cast<string_id_t>((blocks->size() - 1) * block_size + used);
+    used += length;
+
+    return id;
+}
+
+xdccd::string_id_t xdccd::StringArena::add(const std::string &str)
+{
+    return add(str.data(), str.size());
+}
+
+xdccd::StringRef xdccd::StringArena::get(string_id_t id, std::size_t length) const
+{
+    return StringRef{data(id), length};
+}
+
+const char *xdccd::StringArena::data(string_id_t id) const
+{
+    return (*blocks)[id / block_size]->data() + id % block_size;
+}
+
+xdccd::StringArena::View xdccd::StringArena::view() const
+{
+    return View(blocks, block_size);
+}
+
+std::size_t xdccd::StringArena::get_memory_usage() const
+{
+    return blocks->size() * block_size;
+}
+
+xdccd::StringPool::View::View(const ChunkedColumn<StringRef>::View &strings, const StringArena::View &arena)
+    : strings(strings), arena(arena)
+{}
+
+xdccd::StringRef xdccd::StringPool::View::get(string_id_t id) const
+{
+    return strings[id];
+}
+
+std::size_t xdccd::StringPool::View::size() const
+{
+    return strings.size();
+}
+
+xdccd::StringPool::StringPool()
+    : arena(xdccd::arena::POOL_BLOCK_SIZE), key_memory(0)
+{}
+
+xdccd::string_id_t xdccd::StringPool::intern(const std::string &str)
+{
+    // Most strings are known already, do not copy them for the lookup
+    auto it = ids.find(str);
+    if (it != ids.end())
+        return it->second;
+
+    string_id_t id = static_cast<string_id_t>(strings.size());
+    it = ids.insert(std::make_pair(str, id)).first;
+
+    strings.push_back(arena.get(arena.add(str), str.size()));
+    key_memory += sizeof(*it) + it->first.capacity();
+
+    return id;
+}
+
+xdccd::StringRef xdccd::StringPool::get(string_id_t id) const
+{
+    return strings[id];
+}
+
+bool xdccd::StringPool::find(const std::string &str, string_id_t &id) const
+{
+    auto it = ids.find(str);
+    if (it == ids.end())
+        return false;
+
+    id = it->second;
+    return true;
+}
+
+xdccd::StringPool::View xdccd::StringPool::view() const
+{
+    return View(strings.view(), arena.view());
+}
+
+std::size_t xdccd::StringPool::size() const
+{
+    return strings.size();
+}
+
+std::size_t xdccd::StringPool::get_memory_usage() const
+{
+    return strings.get_memory_usage() + arena.get_memory_usage() + key_memory;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "chunkedcolumn.h"
+
+namespace xdccd
+{
+
+typedef std::uint32_t string_id_t;
+
+// Non-owning reference to a string stored somewhere else
+struct StringRef
+{
+    const char *data;
+    std::size_t length;
+
+    std::string str() const;
+    bool operator==(const std::string &other) const;
+};
+
+namespace arena
+{
+static const std::size_t BLOCK_SIZE(1 << 18);
+
+// Pools only hold a few short strings
+static const std::size_t POOL_BLOCK_SIZE(1 << 12);
+}
+
+// Append-only storage for strings. Strings are never moved once added, their
+// ID is their offset into the arena and stays valid as long as the arena or
+// one of its views.
+class StringArena
+{
+    public:
+        typedef std::vector<char> block_t;
+        typedef std::vector<std::shared_ptr<block_t>> directory_t;
+
+        // Read-only view of the strings added so far
+        class View
+        {
+            public:
+                View();
+                View(std::shared_ptr<const directory_t> blocks, std::size_t block_size);
+
+                StringRef get(string_id_t id, std::size_t length) const;
+                const char *data(string_id_t id) const;
+
+            private:
+                std::shared_ptr<const directory_t> blocks;
+                std::size_t block_size;
+        };
+
+        // IDs stay below capacity, adding more throws std::length_error
+        StringArena(std::size_t block_size = arena::BLOCK_SIZE, std::size_t capacity = UINT32_MAX);
+
+        string_id_t add(const char *data, std::size_t length);
+        string_id_t add(const std::string &str);
+
+        StringRef get(string_id_t id, std::size_t length) const;
+        const char *data(string_id_t id) const;
+        View view() const;
+
+        std::size_t get_memory_usage() const;
+
+    private:
+        std::shared_ptr<directory_t> blocks;
+        std::size_t block_size;
+        std::size_t capacity;
+        std::size_t used;
+};
+
+// Maps equal strings onto the same small ID
+class StringPool
+{
+    public:
+        // Read-only view of the strings interned so far
+        class View
+        {
+            public:
+                View() = default;
+                View(const ChunkedColumn<StringRef>::View &strings, const StringArena::View &arena);
+
+                StringRef get(string_id_t id) const;
+                std::size_t size() const;
+
+            private:
+                ChunkedColumn<StringRef>::View strings;
+
+                // Keeps the memory strings point to alive
+                StringArena::View arena;
+        };
+
+        StringPool();
+
+        string_id_t intern(const std::string &str);
+        StringRef get(string_id_t id) const;
+        bool find(const std::string &str, string_id_t &id) const;
+        View view() const;
+
+        std::size_t size() const;
+        std::size_t get_memory_usage() const;
+
+    private:
+        std::unordered_map<std::string, string_id_t> ids;
+        ChunkedColumn<StringRef> strings;
+        StringArena arena;
+        std::size_t key_memory;
+};
+
+}
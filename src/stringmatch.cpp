@@ -0,0 +1,256 @@
+#include <algorithm>
+#include <cstring>
+
+#include "stringmatch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XDCCD_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    struct FoldTable
+    {
+        FoldTable()
+        {
+            for (std::size_t i = 0; i < table.size(); ++i)
+                table[i] = (i >= 'A' && i <= 'Z') ? static_cast<char>(i + ('a' - 'A')) : static_cast<char>(i);
+        }
+
+        std::array<char, 256> table;
+    };
+
+    const FoldTable FOLD;
+
+    typedef bool (*substring_kernel_t)(const char *haystack, std::size_t length, const char *needle, std::size_t needle_length);
+
+    // Needles are at least two characters long, shorter ones are handled by memchr
+    bool contains_scalar(const char *haystack, std::size_t length, const char *needle, std::size_t needle_length)
+    {
+        const char *end = haystack + length;
+        const char *last_start = end - needle_length;
+
+        for (const char *pos = haystack; pos <= last_start; ++pos)
+        {
+            pos = static_cast<const char*>(std::memchr(pos, needle[0], last_start - pos + 1));
+            if (!pos)
+                return false;
+
+            if (pos[needle_length - 1] == needle[needle_length - 1] && std::memcmp(pos + 1, needle + 1, needle_length - 2) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+#ifdef XDCCD_X86_KERNELS
+    // Compares the first and last character of the needle against a block of
+    // possible starts at once, only the positions where both match are
+    // compared in full (see http://0x80.pl/articles/simd-strfind.html)
+    __attribute__((target("sse2")))
+    bool contains_sse2(const char *haystack, std::size_t length, const char *needle, std::size_t needle_length)
+    {
+        const __m128i first = _mm_set1_epi8(needle[0]);
+        const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+
+        std::size_t i = 0;
+        for (; i + needle_length + 15 <= length; i += 16)
+        {
+            __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i));
+            __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(haystack + i + needle_length - 1));
+
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+            for (; mask; mask &= mask - 1)
+            {
+                if (std::memcmp(haystack + i + __builtin_ctz(mask) + 1, needle + 1, needle_length - 2) == 0)
+                    return true;
+            }
+        }
+
+        return i + needle_length <= length && contains_scalar(haystack + i, length - i, needle, needle_length);
+    }
+
+    __attribute__((target("avx2")))
+    bool contains_avx2(const char *haystack, std::size_t length, const char *needle, std::size_t needle_length)
+    {
+        const __m256i first = _mm256_set1_epi8(needle[0]);
+        const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+        std::size_t i = 0;
+        for (; i + needle_length + 31 <= length; i += 32)
+        {
+            __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i));
+            __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(haystack + i + needle_length - 1));
+
+            unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+            for (; mask; mask &= mask - 1)
+            {
+                if (std::memcmp(haystack + i + __builtin_ctz(mask) + 1, needle + 1, needle_length - 2) == 0)
+                    return true;
+            }
+        }
+
+        // Filenames are short, most of them never reach the loop above
+        return i + needle_length <= length && contains_sse2(haystack + i, length - i, needle, needle_length);
+    }
+#endif
+
+    struct SubstringKernel
+    {
+        SubstringKernel()
+            : search(contains_scalar), name("scalar")
+        {
+#ifdef XDCCD_X86_KERNELS
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2"))
+            {
+                search = contains_avx2;
+                name = "avx2";
+            }
+            else if (__builtin_cpu_supports("sse2"))
+            {
+                search = contains_sse2;
+                name = "sse2";
+            }
+#endif
+        }
+
+        substring_kernel_t search;
+        const char *name;
+    };
+
+    // Chosen once, when the program starts
+    const SubstringKernel KERNEL;
+}
+
+char xdccd::fold_case(char c)
+{
+    return FOLD.table[static_cast<unsigned char>(c)];
+}
+
+std::string xdccd::fold_case(const std::string &str)
+{
+    std::string result(str);
+    for (char &c : result)
+        c = fold_case(c);
+
+    return result;
+}
+
+bool xdccd::icontains_folded(const char *haystack, std::size_t length, const std::string &needle)
+{
+    std::size_t needle_length = needle.size();
+
+    if (needle_length == 0)
+        return true;
+
+    if (needle_length > length)
+        return false;
+
+    const char first = needle[0];
+    const char *last_start = haystack + length - needle_length;
+
+    for (const char *pos = haystack; pos <= last_start; ++pos)
+    {
+        if (fold_case(*pos) != first)
+            continue;
+
+        std::size_t i = 1;
+        while (i < needle_length && fold_case(pos[i]) == needle[i])
+            ++i;
+
+        if (i == needle_length)
+            return true;
+    }
+
+    return false;
+}
+
+bool xdccd::icontains_folded(const std::string &haystack, const std::string &needle)
+{
+    return icontains_folded(haystack.data(), haystack.size(), needle);
+}
+
+bool xdccd::contains_folded(const char *haystack, std::size_t length, const std::string &needle)
+{
+    std::size_t needle_length = needle.size();
+
+    if (needle_length == 0)
+        return true;
+
+    if (needle_length > length)
+        return false;
+
+    if (needle_length == 1)
+        return std::memchr(haystack, needle[0], length) != nullptr;
+
+    return KERNEL.search(haystack, length, needle.data(), needle_length);
+}
+
+const char *xdccd::substring_kernel_name()
+{
+    return KERNEL.name;
+}
+
+xdccd::FuzzyPattern::FuzzyPattern(const std::string &pattern)
+    : length(std::min<std::size_t>(pattern.size(), 64))
+{
+    masks.fill(0);
+
+    for (std::size_t i = 0; i < length; ++i)
+        masks[static_cast<unsigned char>(fold_case(pattern[i]))] |= std::uint64_t(1) << i;
+}
+
+unsigned int xdccd::FuzzyPattern::distance(const char *text, std::size_t text_length, unsigned int max_distance) const
+{
+    if (length == 0)
+        return 0;
+
+    // Column of the DP matrix encoded as vertical deltas: bit i of positive
+    // (negative) is set if row i + 1 is one more (less) than row i. Bit i of
+    // diagonal is set if row i + 1 equals row i of the previous column.
+    std::uint64_t positive = ~std::uint64_t(0);
+    std::uint64_t negative = 0;
+    std::uint64_t diagonal = 0;
+    std::uint64_t previous_equal = 0;
+    const std::uint64_t last = std::uint64_t(1) << (length - 1);
+
+    unsigned int score = static_cast<unsigned int>(length);
+    unsigned int best = score;
+
+    for (std::size_t j = 0; j < text_length && best > max_distance; ++j)
+    {
+        std::uint64_t equal = masks[static_cast<unsigned char>(fold_case(text[j]))];
+
+        // Two swapped characters are a single typo (Hyyrö's extension)
+        std::uint64_t transposed = ((~diagonal & equal) << 1) & previous_equal;
+        diagonal = (((equal & positive) + positive) ^ positive) | equal | negative | transposed;
+
+        std::uint64_t horizontal_positive = negative | ~(diagonal | positive);
+        std::uint64_t horizontal_negative = positive & diagonal;
+
+        if (horizontal_positive & last)
+            score++;
+        else if (horizontal_negative & last)
+            score--;
+
+        // A match may start anywhere in the text, so row 0 stays 0
+        horizontal_positive <<= 1;
+        horizontal_negative <<= 1;
+
+        positive = horizontal_negative | ~(diagonal | horizontal_positive);
+        negative = horizontal_positive & diagonal;
+        previous_equal = equal;
+
+        best = std::min(best, score);
+    }
+
+    return best;
+}
+
+std::size_t xdccd::FuzzyPattern::size() const
+{
+    return length;
+}
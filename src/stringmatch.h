@@ -0,0 +1,47 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xdccd
+{
+
+// ASCII case folding, matching boost::algorithm::icontains in the C locale
+char fold_case(char c);
+std::string fold_case(const std::string &str);
+
+// Case-insensitive substring search, needle has to be folded already
+bool icontains_folded(const char *haystack, std::size_t length, const std::string &needle);
+bool icontains_folded(const std::string &haystack, const std::string &needle);
+
+// Substring search for haystacks that are folded already, like the folded
+// filenames of announces. Uses AVX2 or SSE2 if the CPU supports them.
+bool contains_folded(const char *haystack, std::size_t length, const std::string &needle);
+
+// Name of the substring search contains_folded() uses on this CPU
+const char *substring_kernel_name();
+
+// Approximate, case-insensitive substring search, using the bit-parallel
+// algorithm by Myers. Typos are insertions, deletions, substitutions and
+// swaps of adjacent characters. Only the first 64 characters of the pattern
+// are used.
+class FuzzyPattern
+{
+    public:
+        FuzzyPattern(const std::string &pattern);
+
+        // Smallest edit distance between the pattern and any substring of
+        // text, stops looking once it is below max_distance
+        unsigned int distance(const char *text, std::size_t length, unsigned int max_distance = 0) const;
+
+        std::size_t size() const;
+
+    private:
+        // Bit i of masks[c] is set if the pattern has c at position i
+        std::array<std::uint64_t, 256> masks;
+        std::size_t length;
+};
+
+}
@@ -0,0 +1,132 @@
+#include <cstring>
+#include <boost/log/trivial.hpp>
+
+#include "trafficrecorder.h"
+
+xdccd::TrafficRecorder::TrafficRecorder(const boost::filesystem::path &path)
+    : stream(path.string(), std::ios::binary | std::ios::trunc),
+    last_record(std::chrono::steady_clock::now())
+{
+    if (!stream.is_open())
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not open traffic recording '" << path.string() << "'";
+        return;
+    }
+
+    stream.write(xdccd::recorder::MAGIC, sizeof(xdccd::recorder::MAGIC) - 1);
+    stream.put(static_cast<char>(xdccd::recorder::VERSION));
+
+    auto start = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+    write_varint(start.count());
+}
+
+bool xdccd::TrafficRecorder::is_open() const
+{
+    return stream.is_open();
+}
+
+void xdccd::TrafficRecorder::record(const std::string &line)
+{
+    if (line.size() > xdccd::recorder::MAX_LINE_LENGTH)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+
+    write_varint(std::chrono::duration_cast<std::chrono::microseconds>(now - last_record).count());
+    write_varint(line.size());
+    stream.write(line.data(), line.size());
+
+    last_record = now;
+}
+
+void xdccd::TrafficRecorder::flush()
+{
+    stream.flush();
+}
+
+void xdccd::TrafficRecorder::write_varint(std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        stream.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+
+    stream.put(static_cast<char>(value));
+}
+
+xdccd::TrafficReader::TrafficReader(const boost::filesystem::path &path)
+    : stream(path.string(), std::ios::binary),
+    valid(false)
+{
+    char magic[sizeof(xdccd::recorder::MAGIC) - 1];
+    std::uint64_t start = 0;
+
+    if (!stream.read(magic, sizeof(magic)) || std::memcmp(magic, xdccd::recorder::MAGIC, sizeof(magic)) != 0)
+    {
+        BOOST_LOG_TRIVIAL(error) << "'" << path.string() << "' is not a traffic recording";
+        return;
+    }
+
+    if (stream.get() != xdccd::recorder::VERSION || !read_varint(start))
+    {
+        BOOST_LOG_TRIVIAL(error) << "Unsupported traffic recording version in '" << path.string() << "'";
+        return;
+    }
+
+    start_time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::microseconds(start)));
+    valid = true;
+}
+
+bool xdccd::TrafficReader::is_open() const
+{
+    return valid;
+}
+
+std::chrono::system_clock::time_point xdccd::TrafficReader::get_start_time() const
+{
+    return start_time;
+}
+
+bool xdccd::TrafficReader::next(std::chrono::microseconds &delay, std::string &line)
+{
+    std::uint64_t delta, length;
+
+    if (!valid || !read_varint(delta) || !read_varint(length))
+        return false;
+
+    // A truncated or corrupt recording must not make us allocate whatever
+    // its length says
+    if (length > xdccd::recorder::MAX_LINE_LENGTH)
+    {
+        BOOST_LOG_TRIVIAL(error) << "Corrupt record of " << length << " bytes in traffic recording, stopping";
+        valid = false;
+        return false;
+    }
+
+    line.resize(length);
+    if (!stream.read(&line[0], length))
+        return false;
+
+    delay = std::chrono::microseconds(delta);
+    return true;
+}
+
+bool xdccd::TrafficReader::read_varint(std::uint64_t &value)
+{
+    value = 0;
+
+    for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+        int c = stream.get();
+        if (c == std::char_traits<char>::eof())
+            return false;
+
+        value |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+
+        if (!(c & 0x80))
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <boost/filesystem/path.hpp>
+
+namespace xdccd
+{
+
+namespace recorder
+{
+static const char MAGIC[] = "XDCCREC";
+static const std::uint8_t VERSION = 1;
+
+// Far above what servers send (512 bytes plus IRCv3 tags), longer lines are
+// not recorded and longer records are considered corrupt
+static const std::size_t MAX_LINE_LENGTH(65536);
+}
+
+// Writes raw inbound IRC lines to a compact file: a header containing the
+// start time, followed by one record per line, consisting of the time since
+// the previous record (in microseconds) and the line's length as varints,
+// followed by the line itself.
+class TrafficRecorder
+{
+    public:
+        TrafficRecorder(const boost::filesystem::path &path);
+
+        bool is_open() const;
+        void record(const std::string &line);
+        void flush();
+
+    private:
+        void write_varint(std::uint64_t value);
+
+        std::ofstream stream;
+        std::chrono::steady_clock::time_point last_record;
+};
+
+typedef std::shared_ptr<TrafficRecorder> TrafficRecorderPtr;
+
+class TrafficReader
+{
+    public:
+        TrafficReader(const boost::filesystem::path &path);
+
+        bool is_open() const;
+        std::chrono::system_clock::time_point get_start_time() const;
+
+        // Reads the next record, returns false at the end of the recording
+        bool next(std::chrono::microseconds &delay, std::string &line);
+
+    private:
+        bool read_varint(std::uint64_t &value);
+
+        std::ifstream stream;
+        bool valid;
+        std::chrono::system_clock::time_point start_time;
+};
+
+}
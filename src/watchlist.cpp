@@ -0,0 +1,434 @@
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/log/trivial.hpp>
+
+#include "stringmatch.h"
+#include "watchlist.h"
+
+namespace
+{
+    std::vector<std::string> to_strings(const Json::Value &list)
+    {
+        std::vector<std::string> result;
+        for (auto &value : list)
+            result.push_back(value.asString());
+
+        return result;
+    }
+
+    bool contains_name(const std::vector<std::string> &names, xdccd::StringRef name)
+    {
+        return std::any_of(names.begin(), names.end(), [name](const std::string &other)
+        {
+            return other.size() == name.length && std::equal(other.begin(), other.end(), name.data, [](char a, char b) { return xdccd::fold_case(a) == xdccd::fold_case(b); });
+        });
+    }
+
+    Json::Value to_json(const std::vector<std::string> &strings)
+    {
+        Json::Value list(Json::ValueType::arrayValue);
+        for (auto &str : strings)
+            list.append(str);
+
+        return list;
+    }
+}
+
+xdccd::WatchRule::WatchRule()
+    : id(0)
+{
+}
+
+std::vector<std::string> xdccd::WatchRule::get_terms() const
+{
+    std::vector<std::string> terms;
+    std::string folded = fold_case(pattern);
+    boost::algorithm::split(terms, folded, boost::algorithm::is_space(), boost::algorithm::token_compress_on);
+
+    terms.erase(std::remove(terms.begin(), terms.end(), ""), terms.end());
+    std::sort(terms.begin(), terms.end());
+    terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+
+    return terms;
+}
+
+bool xdccd::WatchRule::accepts(const AnnounceRow &row) const
+{
+    if (row.num_size < filter.min_size || row.num_size > filter.max_size || row.download_count < filter.min_downloads)
+        return false;
+
+    if (!filter.bot_names.empty() && !contains_name(filter.bot_names, row.bot_name))
+        return false;
+
+    if (!filter.channels.empty() && !contains_name(filter.channels, row.channel))
+        return false;
+
+    if (filter.extensions.empty())
+        return true;
+
+    const char *end = row.filename.data + row.filename.length;
+    const char *dot = std::find(std::reverse_iterator<const char*>(end), std::reverse_iterator<const char*>(row.filename.data), '.').base();
+
+    return dot != row.filename.data && contains_name(filter.extensions, StringRef{dot, static_cast<std::size_t>(end - dot)});
+}
+
+Json::Value xdccd::WatchRule::to_json() const
+{
+    Json::Value value;
+    value["id"] = id;
+    value["pattern"] = pattern;
+
+    // Unbounded sizes are left out, like in requests
+    Json::Value &filters = value["filters"];
+    if (filter.min_size > 0)
+        filters["min_size"] = static_cast<Json::UInt64>(filter.min_size);
+
+    if (filter.max_size < UINT64_MAX)
+        filters["max_size"] = static_cast<Json::UInt64>(filter.max_size);
+
+    filters["min_downloads"] = filter.min_downloads;
+    filters["bots"] = ::to_json(filter.bot_names);
+    filters["channels"] = ::to_json(filter.channels);
+    filters["extensions"] = ::to_json(filter.extensions);
+
+    return value;
+}
+
+bool xdccd::WatchRule::from_json(const Json::Value &value, WatchRule &rule)
+{
+    if (!value.isObject())
+        return false;
+
+    rule.id = value.get("id", 0).asUInt();
+    rule.pattern = value.get("pattern", "").asString();
+
+    const Json::Value &filters = value["filters"];
+    if (filters.isObject())
+    {
+        if (filters.isMember("min_size"))
+            rule.filter.min_size = xdccd::store::parse_size(filters["min_size"].asString());
+
+        if (filters.isMember("max_size"))
+            rule.filter.max_size = xdccd::store::parse_size(filters["max_size"].asString());
+
+        rule.filter.min_downloads = filters.get("min_downloads", 0).asUInt();
+        rule.filter.bot_names = to_strings(filters["bots"]);
+        rule.filter.channels = to_strings(filters["channels"]);
+        rule.filter.extensions = to_strings(filters["extensions"]);
+    }
+
+    // Rules without terms would download everything
+    return !rule.get_terms().empty();
+}
+
+xdccd::WatchAutomaton::WatchAutomaton(const std::vector<WatchRule> &rules)
+    : rules(rules), class_count(1)
+{
+    // Terms shared by several rules are only matched once
+    std::map<std::string, std::uint32_t> term_ids;
+    std::vector<std::string> terms;
+
+    for (std::size_t i = 0; i < rules.size(); ++i)
+    {
+        std::vector<std::string> rule_term_list = rules[i].get_terms();
+        rule_terms.push_back(rule_term_list.size());
+
+        for (auto &term : rule_term_list)
+        {
+            auto it = term_ids.find(term);
+            if (it == term_ids.end())
+            {
+                it = term_ids.emplace(term, static_cast<std::uint32_t>(terms.size())).first;
+                terms.push_back(term);
+                term_rules.emplace_back();
+            }
+
+            term_rules[it->second].push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+
+    // Characters not part of any term share class 0, which always leads
+    // back to the root
+    classes.fill(0);
+    for (auto &term : terms)
+    {
+        for (char c : term)
+        {
+            std::uint16_t &character_class = classes[static_cast<unsigned char>(c)];
+            if (character_class == 0)
+                character_class = static_cast<std::uint16_t>(class_count++);
+        }
+    }
+
+    // Trie of the terms, children[s] maps the class of the next character to
+    // the next state
+    std::vector<std::map<std::uint16_t, std::uint32_t>> children(1);
+    std::vector<std::vector<std::uint32_t>> state_outputs(1);
+
+    for (std::uint32_t term = 0; term < terms.size(); ++term)
+    {
+        std::uint32_t state = 0;
+        for (char c : terms[term])
+        {
+            std::uint16_t character_class = classes[static_cast<unsigned char>(c)];
+            auto child = children[state].find(character_class);
+
+            if (child == children[state].end())
+            {
+                child = children[state].emplace(character_class, static_cast<std::uint32_t>(children.size())).first;
+                children.emplace_back();
+                state_outputs.emplace_back();
+            }
+
+            state = child->second;
+        }
+
+        state_outputs[state].push_back(term);
+    }
+
+    // Resolve the failure links into transitions breadth first, so the
+    // transitions of shorter prefixes are known when they are needed
+    transitions.assign(children.size() * class_count, 0);
+    std::vector<std::uint32_t> fail(children.size(), 0);
+    std::deque<std::uint32_t> queue;
+
+    for (auto &child : children[0])
+    {
+        transitions[child.first] = child.second;
+        queue.push_back(child.second);
+    }
+
+    while (!queue.empty())
+    {
+        std::uint32_t state = queue.front();
+        queue.pop_front();
+
+        // Terms ending at the longest proper suffix end here as well
+        state_outputs[state].insert(state_outputs[state].end(), state_outputs[fail[state]].begin(), state_outputs[fail[state]].end());
+
+        for (std::size_t c = 0; c < class_count; ++c)
+        {
+            auto child = children[state].find(static_cast<std::uint16_t>(c));
+            std::uint32_t fallback = transitions[fail[state] * class_count + c];
+
+            if (child == children[state].end())
+            {
+                transitions[state * class_count + c] = fallback;
+                continue;
+            }
+
+            fail[child->second] = fallback;
+            transitions[state * class_count + c] = child->second;
+            queue.push_back(child->second);
+        }
+    }
+
+    output_begin.reserve(children.size() + 1);
+    for (auto &state_output : state_outputs)
+    {
+        output_begin.push_back(static_cast<std::uint32_t>(outputs.size()));
+        outputs.insert(outputs.end(), state_output.begin(), state_output.end());
+    }
+
+    output_begin.push_back(static_cast<std::uint32_t>(outputs.size()));
+}
+
+bool xdccd::WatchAutomaton::empty() const
+{
+    return rules.empty();
+}
+
+void xdccd::WatchAutomaton::match(StringRef folded, std::vector<std::size_t> &result) const
+{
+    std::vector<std::uint32_t> found;
+    std::uint32_t state = 0;
+
+    for (std::size_t i = 0; i < folded.length; ++i)
+    {
+        state = transitions[state * class_count + classes[static_cast<unsigned char>(folded.data[i])]];
+        found.insert(found.end(), outputs.begin() + output_begin[state], outputs.begin() + output_begin[state + 1]);
+    }
+
+    if (found.empty())
+        return;
+
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+
+    // A rule matches if every one of its terms was found
+    std::vector<std::uint32_t> hits;
+    for (std::uint32_t term : found)
+        hits.insert(hits.end(), term_rules[term].begin(), term_rules[term].end());
+
+    std::sort(hits.begin(), hits.end());
+
+    for (std::size_t first = 0, last; first < hits.size(); first = last)
+    {
+        for (last = first + 1; last < hits.size() && hits[last] == hits[first]; ++last)
+            ;
+
+        if (last - first == rule_terms[hits[first]])
+            result.push_back(hits[first]);
+    }
+}
+
+const xdccd::WatchRule &xdccd::WatchAutomaton::get_rule(std::size_t index) const
+{
+    return rules[index];
+}
+
+xdccd::WatchList::WatchList()
+    : last_rule_id(0), automaton(std::make_shared<WatchAutomaton>(std::vector<WatchRule>()))
+{
+}
+
+bool xdccd::WatchList::persist(const boost::filesystem::path &path)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    this->path = path;
+
+    if (!boost::filesystem::exists(path))
+        return true;
+
+    Json::Value root;
+    Json::Reader reader;
+    std::ifstream stream(path.string());
+
+    if (!stream.is_open() || !reader.parse(stream, root))
+    {
+        BOOST_LOG_TRIVIAL(error) << "Could not read watch list '" << path.string() << "'";
+        return false;
+    }
+
+    for (auto &value : root["rules"])
+    {
+        WatchRule rule;
+        if (!WatchRule::from_json(value, rule))
+            continue;
+
+        // Keep the IDs rules are known by
+        if (rule.id == 0)
+            rule.id = last_rule_id + 1;
+
+        last_rule_id = std::max(last_rule_id, rule.id);
+        rules.push_back(rule);
+    }
+
+    for (auto &release : root["downloaded"])
+        downloaded.insert(release.asUInt64());
+
+    compile();
+
+    BOOST_LOG_TRIVIAL(info) << "Loaded " << rules.size() << " watch rules and " << downloaded.size() << " downloaded releases from '" << path.string() << "'";
+    return true;
+}
+
+xdccd::watch_rule_id_t xdccd::WatchList::add(WatchRule rule)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    rule.id = ++last_rule_id;
+    rules.push_back(rule);
+
+    compile();
+    save();
+
+    return rule.id;
+}
+
+bool xdccd::WatchList::remove(watch_rule_id_t id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    auto it = std::find_if(rules.begin(), rules.end(), [id](const WatchRule &rule) { return rule.id == id; });
+    if (it == rules.end())
+        return false;
+
+    rules.erase(it);
+
+    compile();
+    save();
+
+    return true;
+}
+
+std::vector<xdccd::WatchRule> xdccd::WatchList::get_rules()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return rules;
+}
+
+xdccd::WatchAutomatonPtr xdccd::WatchList::get_automaton() const
+{
+    return std::atomic_load(&automaton);
+}
+
+bool xdccd::WatchList::claim(release_t release)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if (downloaded.count(release))
+        return false;
+
+    return claimed.insert(release).second;
+}
+
+void xdccd::WatchList::complete(release_t release)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    claimed.erase(release);
+    if (downloaded.insert(release).second)
+        save();
+}
+
+void xdccd::WatchList::abandon(release_t release)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    claimed.erase(release);
+}
+
+std::size_t xdccd::WatchList::get_downloaded_count()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return downloaded.size();
+}
+
+void xdccd::WatchList::compile()
+{
+    std::atomic_store(&automaton, WatchAutomatonPtr(std::make_shared<WatchAutomaton>(rules)));
+}
+
+void xdccd::WatchList::save()
+{
+    if (path.empty())
+        return;
+
+    Json::Value root;
+    root["rules"] = Json::Value(Json::ValueType::arrayValue);
+    for (auto &rule : rules)
+        root["rules"].append(rule.to_json());
+
+    root["downloaded"] = Json::Value(Json::ValueType::arrayValue);
+    for (release_t release : downloaded)
+        root["downloaded"].append(static_cast<Json::UInt64>(release));
+
+    // Replaced atomically, so a crash never leaves a broken list behind
+    boost::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+
+    std::ofstream stream(tmp_path.string(), std::ios::trunc);
+    stream << root;
+    stream.close();
+
+    boost::system::error_code error;
+    if (stream)
+        boost::filesystem::rename(tmp_path, path, error);
+
+    if (!stream || error)
+        BOOST_LOG_TRIVIAL(error) << "Could not write watch list '" << path.string() << "'";
+}
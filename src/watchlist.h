@@ -0,0 +1,145 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include <json/json.h>
+#include <boost/filesystem/path.hpp>
+
+#include "announcestore.h"
+
+namespace xdccd
+{
+
+namespace watch
+{
+// Releases requested from a bot that hasn't started sending them by then are
+// given up, so another bot announcing them can be tried
+static const std::chrono::minutes REQUEST_TIMEOUT(5);
+}
+
+typedef std::uint32_t watch_rule_id_t;
+
+// Downloads releases as soon as they are announced
+struct WatchRule
+{
+    WatchRule();
+
+    watch_rule_id_t id;
+
+    // Terms separated by whitespace, all of which have to be part of the
+    // filename (ignoring case)
+    std::string pattern;
+
+    // Only the sizes, download count and names are used
+    AnnounceFilter filter;
+
+    // Folded terms of pattern, without duplicates
+    std::vector<std::string> get_terms() const;
+
+    // Whether an announce matching the pattern passes the filter as well
+    bool accepts(const AnnounceRow &row) const;
+
+    // Sizes in KiB, like in AnnounceFilter
+    Json::Value to_json() const;
+
+    // Sizes can also be given like in announces ("700M"). Returns false if
+    // value has no pattern.
+    static bool from_json(const Json::Value &value, WatchRule &rule);
+};
+
+// The terms of a set of rules, compiled into an Aho-Corasick automaton. Its
+// transitions are resolved in advance, over the classes of characters terms
+// are made of, so matching takes a single table lookup per character of the
+// filename no matter how many rules there are. Immutable once built.
+class WatchAutomaton
+{
+    public:
+        WatchAutomaton(const std::vector<WatchRule> &rules);
+
+        bool empty() const;
+
+        // Appends the indexes of the rules whose terms all appear in the
+        // folded filename to result, ignoring their filters
+        void match(StringRef folded, std::vector<std::size_t> &result) const;
+
+        const WatchRule &get_rule(std::size_t index) const;
+
+    private:
+        std::vector<WatchRule> rules;
+
+        std::array<std::uint16_t, 256> classes;
+        std::size_t class_count;
+
+        // Next state of state for character class c at state * class_count + c
+        std::vector<std::uint32_t> transitions;
+
+        // Terms ending at state s are outputs[output_begin[s], output_begin[s + 1])
+        std::vector<std::uint32_t> output_begin;
+        std::vector<std::uint32_t> outputs;
+
+        // Rules containing each term, and the number of terms of each rule
+        std::vector<std::vector<std::uint32_t>> term_rules;
+        std::vector<std::size_t> rule_terms;
+};
+
+typedef std::shared_ptr<const WatchAutomaton> WatchAutomatonPtr;
+
+// Rules shared by all bots, along with the releases downloaded for them so
+// far, so none is downloaded twice. Safe to use from any thread.
+class WatchList
+{
+    public:
+        WatchList();
+
+        WatchList(const WatchList&) = delete;
+        WatchList &operator=(const WatchList&) = delete;
+
+        // Loads the rules and downloaded releases saved to path, and saves
+        // them there on every change from now on
+        bool persist(const boost::filesystem::path &path);
+
+        // Returns the ID of the new rule
+        watch_rule_id_t add(WatchRule rule);
+        bool remove(watch_rule_id_t id);
+        std::vector<WatchRule> get_rules();
+
+        // Latest automaton, replaced whenever the rules change
+        WatchAutomatonPtr get_automaton() const;
+
+        // Returns true if release is neither downloaded nor being downloaded,
+        // it is then being downloaded until completed or abandoned
+        bool claim(release_t release);
+
+        // Records a claimed release as downloaded for good
+        void complete(release_t release);
+
+        // Gives up a claimed release, so it can be claimed again
+        void abandon(release_t release);
+
+        std::size_t get_downloaded_count();
+
+    private:
+        // lock has to be held
+        void compile();
+        void save();
+
+        std::mutex lock;
+        std::vector<WatchRule> rules;
+        watch_rule_id_t last_rule_id;
+        std::unordered_set<release_t> downloaded;
+
+        // Being downloaded, these are not saved
+        std::unordered_set<release_t> claimed;
+        boost::filesystem::path path;
+
+        // Only accessed through std::atomic_load/std::atomic_store
+        WatchAutomatonPtr automaton;
+};
+
+}
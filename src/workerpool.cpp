@@ -0,0 +1,66 @@
+#include <boost/log/trivial.hpp>
+
+#include "workerpool.h"
+
+xdccd::WorkerPool::WorkerPool(std::size_t threads)
+    : stop(false)
+{
+    for (std::size_t i = 0; i < threads; ++i)
+        this->threads.emplace_back(&WorkerPool::run, this);
+}
+
+xdccd::WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+
+    available.notify_all();
+
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void xdccd::WorkerPool::post(const work_t &work)
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        queue.push_back(work);
+    }
+
+    available.notify_one();
+}
+
+std::size_t xdccd::WorkerPool::size() const
+{
+    return threads.size();
+}
+
+void xdccd::WorkerPool::run()
+{
+    for (;;)
+    {
+        work_t work;
+
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            available.wait(guard, [this]() { return stop || !queue.empty(); });
+
+            if (queue.empty())
+                return;
+
+            work = std::move(queue.front());
+            queue.pop_front();
+        }
+
+        try
+        {
+            work();
+        }
+        catch (const std::exception &e)
+        {
+            BOOST_LOG_TRIVIAL(error) << "Worker task failed: " << e.what();
+        }
+    }
+}
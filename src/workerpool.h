@@ -0,0 +1,40 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xdccd
+{
+
+typedef std::function<void (void)> work_t;
+
+// Fixed number of threads working off a shared queue. Unlike the
+// ThreadManager, which starts a thread per task, this is meant for many
+// short tasks.
+class WorkerPool
+{
+    public:
+        WorkerPool(std::size_t threads);
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool &operator=(const WorkerPool&) = delete;
+
+        void post(const work_t &work);
+        std::size_t size() const;
+
+    private:
+        void run();
+
+        std::vector<std::thread> threads;
+        std::deque<work_t> queue;
+        std::mutex lock;
+        std::condition_variable available;
+        bool stop;
+};
+
+}
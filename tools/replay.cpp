@@ -0,0 +1,259 @@
+// Replays a traffic recording (see TrafficRecorder) through a DCCBot without
+// touching the network and reports how fast the bot pipeline processes it.
+
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <boost/algorithm/string.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/program_options.hpp>
+
+#include "dccbot.h"
+#include "logging.h"
+#include "trafficrecorder.h"
+
+static std::atomic<std::size_t> allocations(0);
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *ptr = std::malloc(size ? size : 1))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+// Not inlined, otherwise GCC pairs the builtin new with free() and warns
+__attribute__((noinline)) void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+
+// Socket serving the lines of a recording instead of talking to a server
+class ReplaySocket : public xdccd::Socket
+{
+    public:
+        ReplaySocket(boost::asio::io_service &io_service, const std::string &path, bool realtime, std::function<void()> finished_handler)
+            : io_service(io_service), reader(path), realtime(realtime), on_finished(finished_handler),
+            timer(io_service), buffer(nullptr), open(false), has_next(false), lines(0)
+        {}
+
+        virtual void connect(const boost::asio::ip::tcp::endpoint&, boost::system::error_code& error)
+        {
+            open = reader.is_open();
+            error = open ? boost::system::error_code() : boost::asio::error::connection_refused;
+            due = std::chrono::steady_clock::now();
+        }
+
+        virtual void close()
+        {
+            open = false;
+            timer.cancel();
+        }
+
+        virtual void cancel()
+        {
+            timer.cancel();
+        }
+
+        virtual void async_read_until(boost::asio::streambuf& b, const std::string&, std::function<void(const boost::system::error_code&, std::size_t)> handle)
+        {
+            buffer = &b;
+            read_handler = handle;
+            deliver();
+        }
+
+        virtual void async_write(const boost::asio::const_buffers_1 &b, std::function<void(const boost::system::error_code&, std::size_t)> handle)
+        {
+            std::string data(boost::asio::buffer_cast<const char*>(b), boost::asio::buffer_size(b));
+
+            // Answer keepalive probes, so idle periods of the recording do not cause reconnects
+            if (boost::algorithm::starts_with(data, "PING "))
+            {
+                pongs.push_back(":replay PONG replay " + data.substr(5, data.size() - 7));
+                timer.cancel();
+            }
+
+            io_service.post([handle, data]() { handle(boost::system::error_code(), data.size()); });
+        }
+
+        virtual std::string get_address() const
+        {
+            return "127.0.0.1";
+        }
+
+        virtual bool is_open() const
+        {
+            return open;
+        }
+
+        std::size_t get_lines() const
+        {
+            return lines;
+        }
+
+    private:
+        void deliver()
+        {
+            if (!open || !read_handler)
+                return;
+
+            if (!pongs.empty())
+            {
+                put(pongs.front());
+                pongs.pop_front();
+                return;
+            }
+
+            if (!has_next)
+            {
+                std::chrono::microseconds delay;
+                if (!reader.next(delay, next_line))
+                {
+                    read_handler = nullptr;
+                    on_finished();
+                    return;
+                }
+
+                has_next = true;
+                due += delay;
+            }
+
+            if (realtime && due > std::chrono::steady_clock::now())
+            {
+                timer.expires_at(due);
+                timer.async_wait([this](const boost::system::error_code&) { deliver(); });
+                return;
+            }
+
+            has_next = false;
+            lines++;
+            put(next_line);
+        }
+
+        void put(const std::string &line)
+        {
+            std::ostream os(buffer);
+            os << line << "\r\n";
+
+            auto handler = read_handler;
+            std::size_t count = line.size() + 2;
+            read_handler = nullptr;
+
+            io_service.post([handler, count]() { handler(boost::system::error_code(), count); });
+        }
+
+        boost::asio::io_service &io_service;
+        xdccd::TrafficReader reader;
+        bool realtime;
+        std::function<void()> on_finished;
+
+        boost::asio::steady_timer timer;
+        boost::asio::streambuf *buffer;
+        std::function<void(const boost::system::error_code&, std::size_t)> read_handler;
+        bool open;
+
+        std::deque<std::string> pongs;
+        std::string next_line;
+        bool has_next;
+        std::chrono::steady_clock::time_point due;
+        std::size_t lines;
+};
+
+std::size_t resident_memory()
+{
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * 4096;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("recording", po::value<std::string>(), "Traffic recording to replay")
+        ("nick", po::value<std::string>()->default_value("xdccd"), "Nickname the recording was made with")
+        ("realtime", "Replay with the recorded timing instead of at maximum speed")
+        ("verbose", "Show the bot's log output")
+    ;
+
+    po::positional_options_description positional;
+    positional.add("recording", 1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || !vm.count("recording"))
+    {
+        std::cout << "Usage: xdccd-replay [options] <recording>\n" << desc << "\n";
+        return 1;
+    }
+
+    xdccd::setup_logging();
+    if (!vm.count("verbose"))
+        boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::error);
+
+    std::string path = vm["recording"].as<std::string>();
+    bool realtime = vm.count("realtime");
+
+    xdccd::ThreadManager thread_manager;
+    xdccd::ConnectionScheduler scheduler;
+    xdccd::DownloadManager download_manager(thread_manager, ".");
+    xdccd::DCCBot bot(0, "127.0.0.1", "6667", vm["nick"].as<std::string>(), {}, nullptr, scheduler, download_manager);
+
+    ReplaySocket *socket = nullptr;
+    bot.set_socket_factory([&](boost::asio::io_service &io_service)
+    {
+        auto replay = std::make_unique<ReplaySocket>(io_service, path, realtime, [&bot]() { bot.stop(); });
+        socket = replay.get();
+        return std::unique_ptr<xdccd::Socket>(std::move(replay));
+    });
+
+    std::size_t memory_before = resident_memory();
+    std::size_t allocations_before = allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    bot.run();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::size_t allocated = allocations - allocations_before;
+    std::size_t lines = socket ? socket->get_lines() : 0;
+    std::size_t announces = bot.get_announces()->size();
+    std::size_t memory_after = resident_memory();
+
+    if (lines == 0)
+    {
+        std::cerr << "Nothing replayed from '" << path << "'" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Lines:              " << lines << "\n"
+              << "Time:               " << elapsed.count() << "s\n"
+              << "Lines/s:            " << static_cast<std::size_t>(lines / elapsed.count()) << "\n"
+              << "Allocations/line:   " << static_cast<double>(allocated) / lines << "\n"
+              << "Announces:          " << announces << " (" << announces * 1000.0 / lines << " per 1000 lines)\n"
+              << "Announced size:     " << bot.get_total_announces_size() << "K\n"
+              << "Resident growth:    " << (memory_after > memory_before ? (memory_after - memory_before) / 1024 : 0) << "K"
+              << std::endl;
+
+    return 0;
+}
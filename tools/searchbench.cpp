@@ -0,0 +1,383 @@
+// Benchmarks the SearchManager on a synthetic corpus of scene-style
+// announces, fed through DCCBots without touching the network. Reports how
+// long ingesting and indexing takes, the memory used per announce, search
+// latencies for a fixed mix of queries and the throughput of concurrent
+// searchers.
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <boost/algorithm/string.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/program_options.hpp>
+
+#include "dccbot.h"
+#include "logging.h"
+#include "searchmanager.h"
+
+namespace
+{
+
+typedef std::chrono::duration<double, std::milli> milliseconds_t;
+
+const std::vector<std::string> SYLLABLES = {
+    "ka", "lo", "mi", "ra", "ten", "dor", "vel", "sha", "qui", "bran", "zor", "el", "an", "is", "or", "ul",
+    "ek", "tor", "mar", "vin", "sol", "ber", "gun", "hal", "ny", "pe", "ro", "sta", "tri", "wen", "ya", "dus"
+};
+
+const std::vector<std::string> RESOLUTIONS = { "480p", "720p", "1080p", "2160p" };
+const std::vector<std::string> SOURCES = { "HDTV", "WEB-DL", "WEBRip", "BluRay", "DVDRip" };
+const std::vector<std::string> CODECS = { "x264", "x265", "H264", "HEVC", "XviD" };
+const std::vector<std::string> EXTENSIONS = { "mkv", "mkv", "mkv", "mp4", "avi", "rar", "tar" };
+
+struct Release
+{
+    std::string filename;
+    std::string size;
+};
+
+struct Query
+{
+    std::string type;
+    std::string text;
+};
+
+// Generates filenames with a realistic spread of term frequencies: title
+// words are drawn from a Zipf distribution, the rest from small vocabularies
+class CorpusGenerator
+{
+    public:
+        CorpusGenerator(std::size_t vocabulary_size, std::uint64_t seed)
+            : random(seed)
+        {
+            std::vector<double> weights;
+
+            for (std::size_t i = 0; i < vocabulary_size; ++i)
+            {
+                std::string word;
+                std::size_t syllables = 2 + random() % 3;
+                for (std::size_t j = 0; j < syllables; ++j)
+                    word += SYLLABLES[random() % SYLLABLES.size()];
+
+                word[0] = static_cast<char>(std::toupper(word[0]));
+                vocabulary.push_back(word);
+                weights.push_back(1.0 / (i + 1));
+            }
+
+            zipf = std::discrete_distribution<std::size_t>(weights.begin(), weights.end());
+        }
+
+        Release next_release()
+        {
+            Release release;
+            std::string &name = release.filename;
+
+            std::size_t title_words = 1 + random() % 4;
+            for (std::size_t i = 0; i < title_words; ++i)
+                name += pick_word() + ".";
+
+            // Two thirds are episodes of a series, the rest movies
+            bool episode = random() % 3 != 0;
+            if (episode)
+            {
+                char number[16];
+                std::snprintf(number, sizeof(number), "S%02uE%02u.", static_cast<unsigned int>(1 + random() % 12), static_cast<unsigned int>(1 + random() % 24));
+                name += number;
+            }
+            else
+                name += std::to_string(1950 + random() % 75) + ".";
+
+            name += pick(RESOLUTIONS) + "." + pick(SOURCES) + "." + pick(CODECS) + "-" + boost::algorithm::to_upper_copy(pick_word()) + "." + pick(EXTENSIONS);
+
+            // Log-normal sizes around 350M for episodes and 2G for movies
+            std::lognormal_distribution<double> megabytes(episode ? 5.9 : 7.6, 0.8);
+            double size = std::max(1.0, megabytes(random));
+
+            std::ostringstream formatted;
+            if (size >= 1024)
+                formatted << std::fixed << std::setprecision(1) << size / 1024 << "G";
+            else
+                formatted << static_cast<std::size_t>(size) << "M";
+
+            release.size = formatted.str();
+            return release;
+        }
+
+        std::string pick_word()
+        {
+            return vocabulary[zipf(random)];
+        }
+
+        template <typename T>
+        const T &pick(const std::vector<T> &values)
+        {
+            return values[random() % values.size()];
+        }
+
+        std::mt19937_64 &get_random()
+        {
+            return random;
+        }
+
+    private:
+        std::mt19937_64 random;
+        std::vector<std::string> vocabulary;
+        std::discrete_distribution<std::size_t> zipf;
+};
+
+std::size_t resident_memory()
+{
+    std::ifstream statm("/proc/self/statm");
+    std::size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * 4096;
+}
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.0;
+
+    std::size_t rank = std::min(values.size() - 1, static_cast<std::size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+// The queries of every type, drawn from the corpus so most of them match
+std::vector<Query> make_queries(CorpusGenerator &generator, const std::vector<Release> &releases, std::size_t per_type)
+{
+    std::vector<Query> queries;
+    auto &random = generator.get_random();
+
+    for (std::size_t i = 0; i < per_type; ++i)
+    {
+        queries.push_back(Query{"single", generator.pick_word()});
+
+        // Terms of an actual release, the way people narrow down a search
+        std::vector<std::string> terms;
+        const Release &release = releases[random() % releases.size()];
+        boost::algorithm::split(terms, release.filename, boost::algorithm::is_any_of(".-"));
+        std::string multi = terms[0];
+        for (std::size_t j = 1 + random() % 2; j > 0; --j)
+            multi += " " + terms[random() % (terms.size() - 1)];
+
+        queries.push_back(Query{"multi", multi});
+
+        // Part of a word, which no token matches as a whole
+        std::string word = generator.pick_word();
+        while (word.size() < 6)
+            word = generator.pick_word();
+
+        queries.push_back(Query{"substring", word.substr(1, word.size() - 2)});
+
+        std::string nonsense;
+        for (std::size_t j = 0; j < 6; ++j)
+            nonsense += "qxzjvw"[random() % 6];
+
+        queries.push_back(Query{"no-hit", nonsense});
+    }
+
+    return queries;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help", "Show this message")
+        ("announces", po::value<std::size_t>()->default_value(1000000), "Number of announces to generate")
+        ("bots", po::value<std::size_t>()->default_value(16), "Number of bots (networks) to spread them over")
+        ("copies", po::value<double>()->default_value(0.3), "Share of announces offering a release announced before")
+        ("vocabulary", po::value<std::size_t>()->default_value(20000), "Number of distinct title words")
+        ("queries", po::value<std::size_t>()->default_value(200), "Queries per query type")
+        ("searchers", po::value<std::string>()->default_value("1,2,4,8"), "Numbers of concurrent searchers to measure throughput with")
+        ("limit", po::value<std::size_t>()->default_value(xdccd::search::RESULTS_PER_PAGE), "Results per search")
+        ("fuzzy", "Search with typos allowed")
+        ("seed", po::value<std::uint64_t>()->default_value(1), "Seed of the corpus and queries")
+        ("verbose", "Show the bots' log output")
+    ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help"))
+    {
+        std::cout << "Usage: xdccd-searchbench [options]\n" << desc << "\n";
+        return 1;
+    }
+
+    xdccd::setup_logging();
+    if (!vm.count("verbose"))
+        boost::log::core::get()->set_filter(boost::log::trivial::severity >= boost::log::trivial::error);
+
+    std::size_t announce_count = vm["announces"].as<std::size_t>();
+    std::size_t bot_count = std::max<std::size_t>(1, vm["bots"].as<std::size_t>());
+    double copies = vm["copies"].as<double>();
+    std::size_t limit = vm["limit"].as<std::size_t>();
+
+    std::vector<std::size_t> searchers;
+    std::vector<std::string> counts;
+    boost::algorithm::split(counts, vm["searchers"].as<std::string>(), boost::algorithm::is_any_of(","));
+    for (auto &count : counts)
+        searchers.push_back(std::max<std::size_t>(1, std::stoul(count)));
+
+    // Generate the announce lines of every bot up front, so only ingesting
+    // them is measured
+    CorpusGenerator generator(vm["vocabulary"].as<std::size_t>(), vm["seed"].as<std::uint64_t>());
+    auto &random = generator.get_random();
+
+    std::vector<Release> releases;
+    std::vector<std::vector<std::string>> lines(bot_count);
+    std::size_t slot_count = 0;
+
+    for (std::size_t i = 0; i < announce_count; ++i)
+    {
+        // Some releases are offered by several announcers, like in the wild
+        bool copy = !releases.empty() && random() % 1000 < copies * 1000;
+        if (!copy)
+            releases.push_back(generator.next_release());
+
+        const Release &release = copy ? releases[random() % releases.size()] : releases.back();
+
+        // Announcers offer at most 999 slots, like the announce format allows
+        std::size_t bot = i % bot_count;
+        std::size_t slot = lines[bot].size();
+        std::string nick = "Bot|" + std::to_string(bot) + "|" + std::to_string(slot / 999);
+
+        lines[bot].push_back(":" + nick + "!bot@xdcc.example PRIVMSG #chan" + std::to_string(slot / 999 % 4)
+                + " :#" + std::to_string(1 + slot % 999) + " " + std::to_string(random() % 5000) + "x [" + release.size + "] " + release.filename);
+        slot_count++;
+    }
+
+    xdccd::ThreadManager thread_manager;
+    xdccd::ConnectionScheduler scheduler;
+    xdccd::DownloadManager download_manager(thread_manager, ".");
+
+    std::vector<xdccd::DCCBotPtr> bots;
+    for (std::size_t i = 0; i < bot_count; ++i)
+        bots.push_back(std::make_shared<xdccd::DCCBot>(i, "irc.net" + std::to_string(i) + ".example", "6667", "xdccd", std::vector<std::string>(), nullptr, scheduler, download_manager));
+
+    // Every bot has a single writer, but different bots can ingest in parallel
+    std::size_t memory_before = resident_memory();
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> loaders;
+    std::atomic<std::size_t> next_bot(0);
+    for (std::size_t i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i)
+    {
+        loaders.emplace_back([&]()
+        {
+            for (std::size_t bot = next_bot++; bot < bot_count; bot = next_bot++)
+            {
+                for (auto &line : lines[bot])
+                    bots[bot]->read_handler(line);
+
+                bots[bot]->flush_announces();
+            }
+        });
+    }
+
+    for (auto &loader : loaders)
+        loader.join();
+
+    std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - start;
+    std::size_t memory_after = resident_memory();
+
+    std::size_t announces = 0, store_memory = 0, index_memory = 0;
+    for (auto &bot : bots)
+    {
+        xdccd::AnnounceSnapshotPtr snapshot = bot->get_announces();
+        announces += snapshot->size();
+        store_memory += snapshot->get_memory_usage();
+        index_memory += snapshot->get_index_memory_usage();
+    }
+
+    // Lines are no longer needed, and would only distort the memory figures
+    std::vector<std::vector<std::string>>().swap(lines);
+
+    std::cout << "Announces:          " << announces << " on " << bot_count << " bots, " << releases.size() << " releases\n"
+              << "Ingest and index:   " << load_time.count() << "s (" << static_cast<std::size_t>(slot_count / load_time.count()) << " announces/s)\n"
+              << "Store memory:       " << store_memory / 1024 << "K (" << static_cast<double>(store_memory) / std::max<std::size_t>(1, announces) << " bytes/announce)\n"
+              << "Index memory:       " << index_memory / 1024 << "K (" << static_cast<double>(index_memory) / std::max<std::size_t>(1, announces) << " bytes/announce)\n"
+              << "Substring kernel:   " << xdccd::substring_kernel_name() << "\n"
+              << "Resident growth:    " << (memory_after > memory_before ? (memory_after - memory_before) / 1024 : 0) << "K\n"
+              << std::endl;
+
+    std::vector<Query> queries = make_queries(generator, releases, vm["queries"].as<std::size_t>());
+
+    // Nothing is cached, every query is searched
+    xdccd::SearchManager search_manager(0);
+    xdccd::SearchOptions options;
+    options.fuzzy = vm.count("fuzzy");
+
+    std::map<std::string, std::vector<double>> latencies;
+    std::map<std::string, std::size_t> results;
+
+    for (auto &query : queries)
+    {
+        auto query_start = std::chrono::steady_clock::now();
+        xdccd::SearchResultPtr result = search_manager.search(bots, query.text, 0, limit, options);
+        latencies[query.type].push_back(milliseconds_t(std::chrono::steady_clock::now() - query_start).count());
+        results[query.type] += result->total_results;
+    }
+
+    std::cout << std::left << std::setw(12) << "Query" << std::right << std::setw(10) << "p50 ms" << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::setw(14) << "avg results" << "\n";
+    for (auto &type : latencies)
+    {
+        std::cout << std::left << std::setw(12) << type.first << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(10) << percentile(type.second, 0.5)
+                  << std::setw(10) << percentile(type.second, 0.99)
+                  << std::setw(10) << *std::max_element(type.second.begin(), type.second.end())
+                  << std::setw(14) << std::setprecision(1) << static_cast<double>(results[type.first]) / type.second.size() << "\n";
+    }
+
+    std::cout << "\n" << std::left << std::setw(12) << "Searchers" << std::right << std::setw(12) << "queries/s" << std::setw(10) << "p99 ms" << "\n";
+    for (std::size_t count : searchers)
+    {
+        std::vector<std::vector<double>> thread_latencies(count);
+        std::vector<std::thread> threads;
+
+        // Every searcher runs the whole mix, starting at a different query
+        auto throughput_start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            threads.emplace_back([&, i]()
+            {
+                for (std::size_t j = 0; j < queries.size(); ++j)
+                {
+                    const Query &query = queries[(j + i * queries.size() / count) % queries.size()];
+
+                    auto query_start = std::chrono::steady_clock::now();
+                    search_manager.search(bots, query.text, 0, limit, options);
+                    thread_latencies[i].push_back(milliseconds_t(std::chrono::steady_clock::now() - query_start).count());
+                }
+            });
+        }
+
+        for (auto &thread : threads)
+            thread.join();
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - throughput_start;
+
+        std::vector<double> all;
+        for (auto &thread_latency : thread_latencies)
+            all.insert(all.end(), thread_latency.begin(), thread_latency.end());
+
+        std::cout << std::left << std::setw(12) << count << std::right << std::fixed
+                  << std::setw(12) << std::setprecision(1) << all.size() / elapsed.count()
+                  << std::setw(10) << std::setprecision(3) << percentile(all, 0.99) << "\n";
+    }
+
+    std::cout << std::flush;
+
+    return 0;
+}